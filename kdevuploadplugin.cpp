@@ -38,12 +38,19 @@
 #include "uploaddialog.h"
 #include "profilesfiletree.h"
 #include "uploadjob.h"
+#include "uploadfilejob.h"
 #include "uploadprojectmodel.h"
 #include "uploadprofilemodel.h"
 #include "uploadprofileitem.h"
 #include "uploadpreferences.h"
 #include "allprofilesmodel.h"
+#include "uploadconnectionpool.h"
+#include "uploadcontinuoussync.h"
+#include "uploaddirtyset.h"
 #include <interfaces/idocumentcontroller.h>
+#include <KTextEditor/Document>
+#include <QFile>
+#include <QTextCodec>
 
 #include "version.h"
 
@@ -51,6 +58,44 @@ K_PLUGIN_FACTORY_WITH_JSON(UploadFactory, "kdevupload.json", registerPlugin<Uplo
 
 Q_LOGGING_CATEGORY(KDEVUPLOAD, "kdev.upload");
 
+namespace {
+    const qint64 lineEndProbeSize = 64 * 1024; ///< bytes of the saved file read to find its line ends
+
+    /**
+     * Encodes editor text like saving it over localFile would write it.
+     * KTextEditor::Document::text() always joins lines with \n and drops the BOM,
+     * the saved file tells which line ends and BOM the document keeps.
+     */
+    QByteArray encodeLikeSaved(const QString& text, QTextCodec* codec, const QString& localFile)
+    {
+        QByteArray head;
+        QFile file(localFile);
+        if (file.open(QIODevice::ReadOnly)) {
+            head = file.read(lineEndProbeSize);
+        }
+
+        QString saved = text;
+        int newline = head.indexOf('\n');
+        int cr = head.indexOf('\r');
+        if (cr != -1 && newline == cr + 1) {
+            saved.replace('\n', QLatin1String("\r\n"));
+        } else if (cr != -1 && (newline == -1 || cr < newline)) {
+            saved.replace('\n', '\r');
+        }
+
+        if (!codec) {
+            return saved.toUtf8();
+        }
+        QTextEncoder encoder(codec, QTextCodec::IgnoreHeader);
+        QByteArray data = encoder.fromUnicode(saved);
+        if (QTextCodec::codecForUtfText(head, nullptr)) {
+            //the saved file starts with a BOM, the editor keeps it
+            data.prepend(QTextEncoder(codec, QTextCodec::IgnoreHeader).fromUnicode(QString(QChar(QChar::ByteOrderMark))));
+        }
+        return data;
+    }
+}
+
 class FilesTreeViewFactory: public KDevelop::IToolViewFactory{
   public:
     FilesTreeViewFactory(UploadPlugin* plugin, AllProfilesModel* model)
@@ -123,6 +168,13 @@ void UploadPlugin::setupActions()
     m_quickUploadCurrentFile->setIcon(QIcon::fromTheme("go-up"));
     m_projectUploadActionMenu->setEnabled(false);
     connect(m_quickUploadCurrentFile, SIGNAL(triggered(bool)), SLOT(quickUploadCurrentFile()));
+
+    m_quickUploadCurrentBuffer = actionCollection()->addAction("quick_upload_current_buffer");
+    m_quickUploadCurrentBuffer->setText( i18n("Quick Upload &Editor Contents") );
+    m_quickUploadCurrentBuffer->setToolTip(i18n("Upload the text of the current document, without saving it first"));
+    m_quickUploadCurrentBuffer->setIcon(QIcon::fromTheme("go-up"));
+    m_quickUploadCurrentBuffer->setEnabled(false);
+    connect(m_quickUploadCurrentBuffer, SIGNAL(triggered(bool)), SLOT(quickUploadCurrentBuffer()));
 }
 
 void UploadPlugin::projectOpened(KDevelop::IProject* project)
@@ -131,6 +183,8 @@ void UploadPlugin::projectOpened(KDevelop::IProject* project)
     model->setProject(project);
     m_projectProfileModels.insert(project, model);
     m_allProfilesModel->addModel(model);
+    m_continuousSyncs.insert(project, new UploadContinuousSync(this, project, this));
+    projectProfilesChanged(project);
 
     documentActivated(core()->documentController()->activeDocument());
 }
@@ -149,6 +203,23 @@ void UploadPlugin::projectClosed(KDevelop::IProject* project)
         m_allProfilesModel->removeModel(model);
         delete model;
     }
+    delete m_continuousSyncs.take(project);
+}
+
+void UploadPlugin::projectProfilesChanged(KDevelop::IProject* project)
+{
+    //scan once now, so the dialog and quick uploads only look up the modified files
+    KConfigGroup group = project->projectConfiguration()->group("Upload");
+    Q_FOREACH (const QString& g, group.groupList()) {
+        if (g.startsWith("Profile")) {
+            UploadDirtySet::forProfile(project, group.group(g));
+        }
+    }
+
+    UploadContinuousSync* sync = m_continuousSyncs.value(project);
+    if (sync) {
+        sync->update();
+    }
 }
 
 
@@ -156,31 +227,49 @@ void UploadPlugin::documentActivated(KDevelop::IDocument* doc)
 {
     if (!doc) {
         m_quickUploadCurrentFile->setEnabled(false);
+        m_quickUploadCurrentBuffer->setEnabled(false);
         return;
     }
     KDevelop::IProject* project = core()->projectController()->findProjectForUrl(doc->url());
     if (!project) {
         m_quickUploadCurrentFile->setEnabled(false);
+        m_quickUploadCurrentBuffer->setEnabled(false);
         return;
     }
     QList<KDevelop::ProjectFileItem*> files = project->filesForPath(KDevelop::IndexedString(doc->url()));
     if (files.isEmpty()) {
         m_quickUploadCurrentFile->setEnabled(false);
+        m_quickUploadCurrentBuffer->setEnabled(false);
         return;
     }
     UploadProfileModel* profileModel = m_projectProfileModels.value(project);
     if (!profileModel || !profileModel->rowCount()) {
         m_quickUploadCurrentFile->setEnabled(false);
+        m_quickUploadCurrentBuffer->setEnabled(false);
         return;
     }
 
     m_quickUploadCurrentFile->setEnabled(true);
+    m_quickUploadCurrentBuffer->setEnabled(doc->textDocument() != nullptr);
+
+    //a quick upload of this document shouldn't wait for the login
+    for (int i = 0; i < profileModel->rowCount(); i++) {
+        UploadProfileItem* item = profileModel->uploadItem(i);
+        if (item->isDefault()) {
+            UploadConnectionPool* pool = connectionPool(item->url(), item->connections());
+            if (pool) {
+                pool->warmUp();
+            }
+            break;
+        }
+    }
 }
 
 
 void UploadPlugin::documentClosed(KDevelop::IDocument* )
 {
     m_quickUploadCurrentFile->setEnabled(false);
+    m_quickUploadCurrentBuffer->setEnabled(false);
 }
 
 
@@ -275,6 +364,7 @@ void UploadPlugin::quickUpload()
 
     UploadJob* job = new UploadJob(project, model, core()->uiController()->activeMainWindow());
     job->setQuickUpload(true);
+    job->setConnectionPool(connectionPool(model->profileConfigGroup()));
     job->setOutputModel(outputModel());
     job->start();
 }
@@ -282,36 +372,82 @@ void UploadPlugin::quickUpload()
 
 void UploadPlugin::quickUploadCurrentFile()
 {
-    KDevelop::IDocument* doc = core()->documentController()->activeDocument();
+    quickUploadDocument(core()->documentController()->activeDocument(), false);
+}
+
+void UploadPlugin::quickUploadCurrentBuffer()
+{
+    quickUploadDocument(core()->documentController()->activeDocument(), true);
+}
+
+void UploadPlugin::quickUploadDocument(KDevelop::IDocument* doc, bool fromBuffer)
+{
     if (!doc) return;
     KDevelop::IProject* project = KDevelop::ICore::self()->projectController()->findProjectForUrl(doc->url());
     if (!project) return;
     QList<KDevelop::ProjectFileItem*> files = project->filesForPath(KDevelop::IndexedString(doc->url()));
     if (files.isEmpty()) return;
 
-    UploadProjectModel* model = new UploadProjectModel(project);
-    model->setSourceModel(project->projectItem()->model());
-    model->setRootItem(files.first());
-
+    //a single file needs no UploadProjectModel, plan or progress dialog
+    KConfigGroup profile;
     UploadProfileModel* profileModel = m_projectProfileModels.value(project);
     for (int i = 0; i < profileModel->rowCount(); i++) {
         UploadProfileItem* item = profileModel->uploadItem(i);
         if (item->isDefault()) {
-            KConfigGroup c = item->profileConfigGroup();
-            if (c.isValid()) {
-                model->setProfileConfigGroup(c);
-            }
+            profile = item->profileConfigGroup();
             break;
         }
     }
 
-    UploadJob* job = new UploadJob(project, model, core()->uiController()->activeMainWindow());
-    job->setQuickUpload(true);
+    UploadFileJob* job = new UploadFileJob(project, profile, files.first()->path().toUrl(), this);
+    if (profile.isValid()) {
+        job->setConnectionPool(connectionPool(profile));
+    }
+    KTextEditor::Document* textDocument = doc->textDocument();
+    if (fromBuffer && textDocument && textDocument->isModified()) {
+        //encoded like the editor would save it, without touching the file
+        QTextCodec* codec = QTextCodec::codecForName(textDocument->encoding().toLatin1());
+        job->setContents(encodeLikeSaved(textDocument->text(), codec, doc->url().toLocalFile()));
+    }
     job->setOutputModel(outputModel());
     job->start();
+}
+
 
+UploadConnectionPool* UploadPlugin::connectionPool(const QUrl& url, int size)
+{
+    if (url.isEmpty() || url.isLocalFile()) return nullptr;
+
+    QString key = UploadConnectionPool::key(url);
+    UploadConnectionPool* pool = m_connectionPools.value(key);
+    if (!pool) {
+        pool = new UploadConnectionPool(url, size, this);
+        connect(pool, SIGNAL(warmthChanged(QUrl, bool)),
+                this, SLOT(connectionWarmthChanged(QUrl, bool)));
+        m_connectionPools.insert(key, pool);
+    } else if (pool->size() != size) {
+        pool->setSize(size);
+    }
+    return pool;
 }
 
+UploadConnectionPool* UploadPlugin::connectionPool(const KConfigGroup& profile)
+{
+    return connectionPool(profile.readEntry("url", QUrl()),
+                          profile.readEntry("connections", static_cast<int>(UploadProfileItem::DefaultConnections)));
+}
+
+void UploadPlugin::connectionWarmthChanged(const QUrl& url, bool warm)
+{
+    qCDebug(KDEVUPLOAD) << "connection" << url << (warm ? "warm" : "cold");
+    //don't create the output view just for this
+    if (!m_outputModel) return;
+    if (warm) {
+        m_outputModel->appendRow(new QStandardItem(i18n("Connected to %1", url.toDisplayString())));
+    } else {
+        m_outputModel->appendRow(new QStandardItem(i18n("Disconnected from %1", url.toDisplayString())));
+    }
+}
 
 QStandardItemModel* UploadPlugin::outputModel()
 {
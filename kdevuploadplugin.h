@@ -11,7 +11,9 @@
 #ifndef KDEVUPLOADPLUGIN_H
 #define KDEVUPLOADPLUGIN_H
 
+#include <QHash>
 #include <QList>
+#include <QUrl>
 #include <QtCore/QVariant>
 
 #include <interfaces/iplugin.h>
@@ -28,6 +30,9 @@ namespace KDevelop {
 class UploadProfileModel;
 class FilesTreeViewFactory;
 class AllProfilesModel;
+class UploadConnectionPool;
+class UploadContinuousSync;
+class KConfigGroup;
 
 class UploadPlugin : public KDevelop::IPlugin
 {
@@ -47,6 +52,25 @@ public:
     */
     QStandardItemModel* outputModel();
     
+    /**
+    * Returns (and creates) the pool of connected workers for the server of url.
+    * Profiles on the same server share the pool.
+    * @param size number of connections the pool keeps open
+    * @return nullptr for local urls, they don't need a connection
+    */
+    UploadConnectionPool* connectionPool(const QUrl& url, int size);
+
+    /**
+    * Returns the pool for the server of an upload profile, with the connections set in the profile
+    */
+    UploadConnectionPool* connectionPool(const KConfigGroup& profile);
+
+    /**
+    * Called after the profiles of project were changed. Starts the dirty sets of
+    * new profiles and rereads which profiles have continuous sync enabled.
+    */
+    void projectProfilesChanged(KDevelop::IProject* project);
+
     int perProjectConfigPages() const override;
     KDevelop::ConfigPage* perProjectConfigPage(int number, const KDevelop::ProjectConfigOptions& options, QWidget* parent) override;
 
@@ -71,6 +95,11 @@ private Q_SLOTS:
 
     void quickUploadCurrentFile();
 
+    /**
+    * Uploads the text of the active document as it is in the editor, without saving it.
+    */
+    void quickUploadCurrentBuffer();
+
     /**
     * Called when project was opened, adds a upload-action to the project-menu.
     */
@@ -87,21 +116,34 @@ private Q_SLOTS:
     void profilesRowChanged();
 
     void documentActivated(KDevelop::IDocument*);
+
+    /**
+    * Logs when the connection of a pool is opened or closed
+    */
+    void connectionWarmthChanged(const QUrl& url, bool warm);
     void documentClosed(KDevelop::IDocument*);
 
 private:
     void setupActions();
 
+    /**
+    * Uploads a document of a project to the default profile, from the editor buffer if fromBuffer is set
+    */
+    void quickUploadDocument(KDevelop::IDocument* doc, bool fromBuffer);
+
     QList<KDevelop::ProjectBaseItem*> m_ctxUrlList; ///< selected files when the contextmenu was requested
 
     KActionMenu* m_projectUploadActionMenu; ///< upload ActionMenu, displayed in the Project-Menu
     QAction* m_quickUploadCurrentFile;
+    QAction* m_quickUploadCurrentBuffer; ///< uploads the unsaved editor text of the current file
     QMap<KDevelop::IProject*, QAction*> m_projectUploadActions; ///< upload actions for every open project
     QMap<KDevelop::IProject*, UploadProfileModel*> m_projectProfileModels; ///< UploadProfileModels for every open project
     QSignalMapper* m_signalMapper; ///< signal mapper for upload actions, to get the correct project
     QStandardItemModel* m_outputModel; ///< model for log-output
     FilesTreeViewFactory* m_filesTreeViewFactory; ///< factory for ProjectFilesTree
     AllProfilesModel* m_allProfilesModel; ///< model for all profiles
+    QHash<QString, UploadConnectionPool*> m_connectionPools; ///< connected workers by server
+    QMap<KDevelop::IProject*, UploadContinuousSync*> m_continuousSyncs; ///< continuous sync for every open project
 };
 
 #endif
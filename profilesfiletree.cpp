@@ -33,6 +33,8 @@
 #include "allprofilesmodel.h"
 #include "uploadprofileitem.h"
 #include "uploadprofiledlg.h"
+#include "uploadconnectionpool.h"
+#include "kdevuploadplugin.h"
 
 ProfilesFileTree::ProfilesFileTree(UploadPlugin* plugin, QWidget *parent)
     : QWidget(parent), m_plugin(plugin), m_editProfileDlg(nullptr)
@@ -143,6 +145,11 @@ void ProfilesFileTree::profileIndexChanged(int index)
         if (m_tree->url() != item->url()) {
             m_tree->setUrl(item->url(), true);
         }
+        //uploads to this profile find the connections open and logged in already
+        UploadConnectionPool* pool = m_plugin->connectionPool(item->url(), item->connections());
+        if (pool) {
+            pool->warmUp();
+        }
     } else {
         profileIndexChanged(-1);
     }
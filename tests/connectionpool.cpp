@@ -0,0 +1,106 @@
+#include <QDebug>
+#include <QApplication>
+#include <QBuffer>
+#include <QFile>
+#include <QLoggingCategory>
+#include <QTemporaryDir>
+#include <kio/transferjob.h>
+#include <cstring>
+
+#include "uploadconnectionpool.h"
+
+//defined by the plugin, which isn't linked
+Q_LOGGING_CATEGORY(KDEVUPLOAD, "kdev.upload")
+
+namespace {
+    /**
+     * Device that delivers some bytes and then fails, like a file on a disk that goes away
+     */
+    class FailingDevice : public QIODevice
+    {
+    public:
+        FailingDevice(qint64 size, qint64 failAt) : m_size(size), m_failAt(failAt), m_pos(0) {}
+
+        bool isSequential() const override {
+            return false;
+        }
+        qint64 size() const override {
+            return m_size;
+        }
+
+    protected:
+        qint64 readData(char* data, qint64 maxSize) override
+        {
+            if (m_pos >= m_failAt) {
+                setErrorString("Input/output error");
+                return -1;
+            }
+            qint64 n = qMin(maxSize, m_failAt - m_pos);
+            memset(data, 'x', n);
+            m_pos += n;
+            return n;
+        }
+        qint64 writeData(const char*, qint64) override {
+            return -1;
+        }
+
+    private:
+        qint64 m_size;
+        qint64 m_failAt;
+        qint64 m_pos;
+    };
+
+    void check(bool condition, const char* what)
+    {
+        if (!condition) {
+            qFatal("FAILED: %s", what);
+        }
+        qDebug() << "ok" << what;
+    }
+
+    void testPut(UploadConnectionPool* pool, const QString& dir)
+    {
+        QByteArray content(600 * 1024, 'a');
+        QBuffer* source = new QBuffer;
+        source->setData(content);
+        source->open(QIODevice::ReadOnly);
+        QUrl dest = QUrl::fromLocalFile(dir + "/complete");
+        KIO::TransferJob* job = pool->put(source, dest);
+        job->setAutoDelete(false);
+        check(job->exec(), "put: succeeds");
+        check(UploadConnectionPool::readError(job).isEmpty(), "put: no read error");
+        delete job;
+
+        QFile written(dest.toLocalFile());
+        written.open(QIODevice::ReadOnly);
+        check(written.readAll() == content, "put: all chunks written");
+    }
+
+    void testFailingSource(UploadConnectionPool* pool, const QString& dir)
+    {
+        //fails after the first chunk, with more of the file still to come
+        FailingDevice* source = new FailingDevice(1024 * 1024, 256 * 1024);
+        source->open(QIODevice::ReadOnly);
+        KIO::TransferJob* job = pool->put(source, QUrl::fromLocalFile(dir + "/truncated"));
+        job->setAutoDelete(false);
+        check(!job->exec(), "failing source: the put fails instead of ending early");
+        check(!UploadConnectionPool::readError(job).isEmpty(), "failing source: the read error is reported");
+        delete job;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    QApplication app(argc, argv);
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        qFatal("can't create a temporary directory");
+    }
+    //local destinations run on the scheduler's workers, the put goes through the same chunking
+    UploadConnectionPool pool(QUrl::fromLocalFile(dir.path()), 1);
+    testPut(&pool, dir.path());
+    testFailingSource(&pool, dir.path());
+    qDebug() << "all connection pool tests passed";
+    return 0;
+}
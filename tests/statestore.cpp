@@ -0,0 +1,230 @@
+#include <QDebug>
+#include <QApplication>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QLoggingCategory>
+#include <QTemporaryDir>
+#include <kconfig.h>
+#include <kconfiggroup.h>
+
+#include <tests/autotestshell.h>
+#include <tests/testcore.h>
+#include <tests/testproject.h>
+#include <util/path.h>
+
+#include "uploadstatestore.h"
+
+//defined by the plugin, which isn't linked
+Q_LOGGING_CATEGORY(KDEVUPLOAD, "kdev.upload")
+
+/**
+ * Test project whose developer file, and so the upload state files, are in a temporary directory
+ */
+class StateProject : public KDevelop::TestProject
+{
+public:
+    explicit StateProject(const QString& dir)
+        : KDevelop::TestProject(KDevelop::Path(dir)), m_developerFile(KDevelop::Path(dir), ".kdev4/test.kdev4") {}
+
+    KDevelop::Path developerFile() const override {
+        return m_developerFile;
+    }
+
+private:
+    KDevelop::Path m_developerFile;
+};
+
+namespace {
+    void check(bool condition, const char* what)
+    {
+        if (!condition) {
+            qFatal("FAILED: %s", what);
+        }
+        qDebug() << "ok" << what;
+    }
+
+    UploadFingerprint fingerprint(int n)
+    {
+        QByteArray hash = QCryptographicHash::hash(QByteArray::number(n), QCryptographicHash::Md5);
+        return UploadFingerprint(1000 + n, 1500000000000LL + n, 42 + n, hash);
+    }
+
+    /**
+     * Returns where the store of a profile keeps its state
+     */
+    QString stateFile(KDevelop::IProject* project, const QString& profileGroup)
+    {
+        return KDevelop::Path(project->developerFile().parent(), "upload-" + profileGroup + ".state").toLocalFile();
+    }
+
+    /**
+     * Writes one journal record per path with the store of profile, then copies its files
+     * to the profile crashed, as they would be left behind if the process died now
+     */
+    void writeJournal(KDevelop::IProject* project, KConfig* config, const QString& profile,
+                      const QString& crashed, const QStringList& paths)
+    {
+        UploadStateStore* store = UploadStateStore::forProfile(project, config->group(profile));
+        for (int i = 0; i < paths.count(); ++i) {
+            store->setFingerprint(paths.at(i), fingerprint(i));
+            store->sync();
+        }
+        QString from = stateFile(project, profile);
+        QString to = stateFile(project, crashed);
+        UploadStateStore::discard(project, crashed);
+        QFile::copy(from, to);
+        QFile::copy(from + ".journal", to + ".journal");
+        delete store;
+    }
+
+    void testRoundTrip(KDevelop::IProject* project, KConfig* config)
+    {
+        QStringList paths;
+        paths << "src/main.cpp" << "README" << "src/a/b/c.h" << QString::fromUtf8("doc/\xc3\xa4rger.txt") << "Makefile";
+        QDateTime time = QDateTime::fromMSecsSinceEpoch(1400000000000LL);
+
+        UploadStateStore* store = UploadStateStore::forProfile(project, config->group("RoundTrip"));
+        for (int i = 0; i < paths.count(); ++i) {
+            store->setFingerprint(paths.at(i), fingerprint(i));
+        }
+        store->setUploaded(QStringList() << "README" << "legacy.txt", time);
+        check(store->compact(), "round trip: compact");
+        check(!QFile::exists(stateFile(project, "RoundTrip") + ".journal"), "round trip: journal removed by compact");
+        delete store;
+
+        store = UploadStateStore::forProfile(project, config->group("RoundTrip"));
+        check(store->paths().count() == paths.count() + 1, "round trip: all entries read back");
+        for (int i = 0; i < paths.count(); ++i) {
+            UploadFingerprint f = store->fingerprint(paths.at(i));
+            check(f.sameStat(fingerprint(i)) && f.hash() == fingerprint(i).hash(), "round trip: fingerprint found by binary search");
+        }
+        check(store->uploadTime("README") == time, "round trip: upload time");
+        check(store->contains("legacy.txt") && !store->fingerprint("legacy.txt").isValid(), "round trip: entry without fingerprint");
+        check(!store->contains("src/main"), "round trip: prefix of a path is not found");
+        check(!store->contains("zzz"), "round trip: path after the last record is not found");
+
+        store->remove("src/a/b/c.h");
+        delete store;
+        store = UploadStateStore::forProfile(project, config->group("RoundTrip"));
+        check(!store->contains("src/a/b/c.h"), "round trip: removed entry stays removed");
+        delete store;
+    }
+
+    void testReplay(KDevelop::IProject* project, KConfig* config)
+    {
+        QStringList paths;
+        paths << "one" << "two" << "three";
+        writeJournal(project, config, "Replay", "ReplayCrashed", paths);
+        QString crashed = stateFile(project, "ReplayCrashed");
+        check(QFile(crashed + ".journal").size() > 0, "replay: journal left behind");
+
+        UploadStateStore* store = UploadStateStore::forProfile(project, config->group("ReplayCrashed"));
+        for (int i = 0; i < paths.count(); ++i) {
+            check(store->fingerprint(paths.at(i)).sameStat(fingerprint(i)), "replay: journal record applied");
+        }
+        check(!QFile::exists(crashed + ".journal"), "replay: journal folded into the state file");
+        delete store;
+
+        store = UploadStateStore::forProfile(project, config->group("ReplayCrashed"));
+        check(store->paths().count() == paths.count(), "replay: entries are in the state file");
+        delete store;
+    }
+
+    void testTruncatedJournal(KDevelop::IProject* project, KConfig* config)
+    {
+        QStringList paths;
+        paths << "one" << "two" << "three";
+        writeJournal(project, config, "Truncated", "TruncatedCrashed", paths);
+        QFile journal(stateFile(project, "TruncatedCrashed") + ".journal");
+        journal.resize(journal.size() - 3);
+
+        UploadStateStore* store = UploadStateStore::forProfile(project, config->group("TruncatedCrashed"));
+        check(store->contains("one") && store->contains("two"), "truncated journal: complete records replayed");
+        check(!store->contains("three"), "truncated journal: incomplete record ignored");
+        delete store;
+    }
+
+    void testCorruptJournal(KDevelop::IProject* project, KConfig* config)
+    {
+        QStringList paths;
+        paths << "one" << "two" << "three";
+        writeJournal(project, config, "Corrupt", "CorruptCrashed", paths);
+
+        QFile journal(stateFile(project, "CorruptCrashed") + ".journal");
+        journal.open(QIODevice::ReadWrite);
+        QByteArray data = journal.readAll();
+        data[data.size() - 1] = data.at(data.size() - 1) ^ 0x5a;
+        journal.seek(0);
+        journal.write(data);
+        journal.close();
+
+        UploadStateStore* store = UploadStateStore::forProfile(project, config->group("CorruptCrashed"));
+        check(store->contains("one") && store->contains("two"), "corrupt journal: records before the damage replayed");
+        check(!store->contains("three"), "corrupt journal: record with a bad checksum ignored");
+        delete store;
+
+        //garbage after complete records, eg. a partly written length
+        writeJournal(project, config, "Corrupt", "CorruptCrashed", paths);
+        QFile tail(stateFile(project, "CorruptCrashed") + ".journal");
+        tail.open(QIODevice::Append);
+        tail.write("\x40\x00", 2);
+        tail.close();
+        store = UploadStateStore::forProfile(project, config->group("CorruptCrashed"));
+        check(store->paths().count() == paths.count(), "corrupt journal: partial header ignored");
+        delete store;
+    }
+
+    void testMigration(KDevelop::IProject* project, KConfig* config)
+    {
+        QDateTime time = QDateTime::fromMSecsSinceEpoch(1300000000000LL);
+        KConfigGroup profile = config->group("Upload").group("Migration");
+        profile.writeEntry("name", "Server");
+        profile.writeEntry("url", "sftp://example.org/www");
+        profile.writeEntry("src/main.cpp", time);
+        profile.writeEntry("index.html", time);
+        profile.group("Fingerprints").writeEntry("src/main.cpp", fingerprint(7).toString());
+        config->sync();
+
+        UploadStateStore* store = UploadStateStore::forProfile(project, profile);
+        check(store->uploadTime("src/main.cpp") == time && store->uploadTime("index.html") == time, "migration: upload times moved");
+        check(store->fingerprint("src/main.cpp").hash() == fingerprint(7).hash(), "migration: fingerprint moved");
+        check(!store->contains("name") && !store->contains("url"), "migration: profile settings left alone");
+        check(QFile::exists(stateFile(project, "Migration")), "migration: state file written");
+        delete store;
+
+        check(profile.readEntry("name", QString()) == "Server", "migration: settings kept in the config");
+        check(!profile.hasKey("src/main.cpp") && profile.group("Fingerprints").keyList().isEmpty(),
+              "migration: entries removed from the config");
+
+        //the state file exists now, the config is not read again
+        profile.writeEntry("late.txt", time);
+        store = UploadStateStore::forProfile(project, profile);
+        check(store->contains("index.html") && !store->contains("late.txt"), "migration: only once");
+        delete store;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    QApplication app(argc, argv);
+    KDevelop::AutoTestShell::init();
+    KDevelop::TestCore::initialize(KDevelop::Core::NoUi);
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        qFatal("can't create a temporary directory");
+    }
+    KConfig config(dir.path() + "/test.kdev4", KConfig::SimpleConfig);
+    StateProject* project = new StateProject(dir.path());
+
+    testRoundTrip(project, &config);
+    testReplay(project, &config);
+    testTruncatedJournal(project, &config);
+    testCorruptJournal(project, &config);
+    testMigration(project, &config);
+
+    delete project;
+    KDevelop::TestCore::shutdown();
+    qDebug() << "all upload state store tests passed";
+    return 0;
+}
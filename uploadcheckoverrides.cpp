@@ -0,0 +1,120 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+#include "uploadcheckoverrides.h"
+
+#include <algorithm>
+
+namespace {
+    inline quint64 pack(uint id, Qt::CheckState state)
+    {
+        return (static_cast<quint64>(id) << 32) | static_cast<quint64>(state);
+    }
+    inline uint idOf(quint64 entry)
+    {
+        return static_cast<uint>(entry >> 32);
+    }
+    inline bool lessId(quint64 a, quint64 b)
+    {
+        return idOf(a) < idOf(b);
+    }
+}
+
+UploadCheckOverrides::UploadCheckOverrides()
+    : m_sorted(0)
+{
+}
+
+void UploadCheckOverrides::merge() const
+{
+    if (m_sorted == m_entries.count()) return;
+
+    //stable, so the last insert of an id comes last among equal ids
+    std::stable_sort(m_entries.begin() + m_sorted, m_entries.end(), lessId);
+    std::inplace_merge(m_entries.begin(), m_entries.begin() + m_sorted, m_entries.end(), lessId);
+
+    //keep the last entry of each id
+    int out = 0;
+    for (int i = 0; i < m_entries.count(); ++i) {
+        if (i + 1 < m_entries.count() && idOf(m_entries.at(i)) == idOf(m_entries.at(i + 1))) {
+            continue;
+        }
+        m_entries[out++] = m_entries.at(i);
+    }
+    m_entries.resize(out);
+    m_sorted = out;
+}
+
+int UploadCheckOverrides::find(uint id) const
+{
+    QVector<quint64>::const_iterator begin = m_entries.constBegin();
+    QVector<quint64>::const_iterator end = begin + m_sorted;
+    QVector<quint64>::const_iterator it = std::lower_bound(begin, end, pack(id, Qt::Unchecked), lessId);
+    if (it != end && idOf(*it) == id) {
+        return it - begin;
+    }
+    return -1;
+}
+
+bool UploadCheckOverrides::contains(uint id) const
+{
+    merge();
+    return find(id) != -1;
+}
+
+Qt::CheckState UploadCheckOverrides::value(uint id) const
+{
+    merge();
+    int pos = find(id);
+    if (pos == -1) return Qt::Unchecked;
+    return static_cast<Qt::CheckState>(m_entries.at(pos) & 0xff);
+}
+
+void UploadCheckOverrides::insert(uint id, Qt::CheckState state)
+{
+    int pos = find(id);
+    if (pos != -1) {
+        m_entries[pos] = pack(id, state);
+    } else {
+        m_entries.append(pack(id, state));
+    }
+}
+
+void UploadCheckOverrides::remove(uint id)
+{
+    merge();
+    int pos = find(id);
+    if (pos != -1) {
+        m_entries.remove(pos);
+        --m_sorted;
+    }
+}
+
+void UploadCheckOverrides::clear()
+{
+    m_entries.clear();
+    m_sorted = 0;
+}
+
+int UploadCheckOverrides::count() const
+{
+    merge();
+    return m_entries.count();
+}
+
+QVector<uint> UploadCheckOverrides::ids() const
+{
+    merge();
+    QVector<uint> ret;
+    ret.reserve(m_entries.count());
+    Q_FOREACH (quint64 entry, m_entries) {
+        ret << idOf(entry);
+    }
+    return ret;
+}
+
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
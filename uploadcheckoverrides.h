@@ -0,0 +1,67 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+
+#ifndef UPLOADCHECKOVERRIDES_H
+#define UPLOADCHECKOVERRIDES_H
+
+#include <QVector>
+#include <qnamespace.h>
+
+/**
+ * Check states the user selected, keyed by the index of an interned path
+ * (KDevelop::IndexedString::index()).
+ *
+ * Entries are packed into one sorted vector of 64 bit values, the path id in
+ * the upper and the state in the lower bits. New entries are appended and
+ * merged into the sorted part on the next lookup, so bulk selections don't
+ * move the vector for every item.
+ */
+class UploadCheckOverrides
+{
+public:
+    UploadCheckOverrides();
+
+    bool contains(uint id) const;
+
+    /**
+     * Returns the selected state of a path, Qt::Unchecked if there is none
+     */
+    Qt::CheckState value(uint id) const;
+
+    void insert(uint id, Qt::CheckState state);
+    void remove(uint id);
+    void clear();
+
+    bool isEmpty() const {
+        return m_entries.isEmpty();
+    }
+    int count() const;
+
+    /**
+     * Returns the path ids of all entries, sorted
+     */
+    QVector<uint> ids() const;
+
+private:
+    /**
+     * Sorts the appended entries into the sorted part, the last insert of a path wins
+     */
+    void merge() const;
+
+    /**
+     * Binary search in the sorted part
+     * @return position or -1
+     */
+    int find(uint id) const;
+
+    mutable QVector<quint64> m_entries;
+    mutable int m_sorted; ///< number of entries at the front that are sorted
+};
+
+#endif
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
@@ -0,0 +1,125 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+#include "uploadconcurrency.h"
+
+#include <QtGlobal>
+#include "kdevuploaddebug.h"
+
+namespace {
+    const qint64 minimumWindowMsecs = 500; ///< shorter windows are too noisy to compare
+    const qulonglong sizeClassLimits[] = { 64 * 1024, 1024 * 1024, 16 * 1024 * 1024 }; ///< upper bounds, the last class takes the rest
+}
+
+UploadConcurrency::UploadConcurrency(int limit, int ceiling)
+    : m_limit(qBound(1, limit, static_cast<int>(MaximumLimit))),
+      m_ceiling(qBound(1, ceiling, static_cast<int>(MaximumLimit))),
+      m_maximum(MaximumLimit), m_goodWindows(0), m_windowBytes(0), m_windowJobs(0), m_lastThroughput(0)
+{
+    m_limit = qMin(m_limit, m_ceiling);
+    for (int c = 0; c < SizeClasses; ++c) {
+        m_windowLatency[c] = 0;
+        m_windowClassJobs[c] = 0;
+        m_bestLatency[c] = 0;
+    }
+}
+
+void UploadConcurrency::setMaximum(int maximum)
+{
+    m_maximum = qBound(1, maximum, static_cast<int>(MaximumLimit));
+    m_limit = qMin(m_limit, m_maximum);
+}
+
+int UploadConcurrency::sizeClass(qulonglong bytes)
+{
+    int c = 0;
+    while (c < SizeClasses - 1 && bytes >= sizeClassLimits[c]) {
+        ++c;
+    }
+    return c;
+}
+
+void UploadConcurrency::jobFinished(qulonglong bytes, qint64 msecs)
+{
+    if (!m_window.isValid()) {
+        m_window.start();
+    }
+    m_windowBytes += bytes;
+    ++m_windowJobs;
+    int c = sizeClass(bytes);
+    m_windowLatency[c] += msecs;
+    ++m_windowClassJobs[c];
+
+    if (m_windowJobs >= m_limit && m_window.elapsed() >= minimumWindowMsecs) {
+        closeWindow();
+    }
+}
+
+void UploadConcurrency::jobFailed()
+{
+    m_ceiling = qMax(1, m_limit - 1);
+    m_limit = qMax(1, m_limit / 2);
+    m_goodWindows = 0;
+    qCDebug(KDEVUPLOAD) << "job failed, concurrency lowered to" << m_limit << "ceiling" << m_ceiling;
+
+    //the running window mixes both limits, start over
+    m_window.invalidate();
+    m_windowBytes = 0;
+    m_windowJobs = 0;
+    for (int c = 0; c < SizeClasses; ++c) {
+        m_windowLatency[c] = 0;
+        m_windowClassJobs[c] = 0;
+    }
+    m_lastThroughput = 0;
+}
+
+void UploadConcurrency::closeWindow()
+{
+    double throughput = static_cast<double>(m_windowBytes) / qMax<qint64>(1, m_window.elapsed());
+
+    //a window of big files isn't slower per job than one of small files, only compare files of about the same size
+    bool slower = false;
+    for (int c = 0; c < SizeClasses; ++c) {
+        if (!m_windowClassJobs[c]) continue;
+        double latency = static_cast<double>(m_windowLatency[c]) / m_windowClassJobs[c];
+        if (m_bestLatency[c] == 0 || latency < m_bestLatency[c]) {
+            m_bestLatency[c] = latency;
+        }
+        if (latency > m_bestLatency[c] * 2) {
+            slower = true;
+        }
+    }
+
+    if (slower || (m_lastThroughput > 0 && throughput < m_lastThroughput * 0.9)) {
+        //more jobs made every file slower or the total got worse
+        m_ceiling = qMax(1, m_limit - 1);
+        m_limit = m_ceiling;
+        m_goodWindows = 0;
+    } else if (m_limit < m_maximum && (m_lastThroughput == 0 || throughput > m_lastThroughput * 1.05)) {
+        if (m_limit < m_ceiling) {
+            ++m_limit;
+        } else if (++m_goodWindows >= 3 && m_ceiling < MaximumLimit) {
+            //probe again above a ceiling learned earlier
+            ++m_ceiling;
+            ++m_limit;
+            m_goodWindows = 0;
+        }
+    }
+    qCDebug(KDEVUPLOAD) << "concurrency window" << throughput << "bytes/ms" << m_windowJobs << "jobs"
+                        << (slower ? "slower" : "") << "-> limit" << m_limit << "ceiling" << m_ceiling;
+
+    m_lastThroughput = throughput;
+    m_window.restart();
+    m_windowBytes = 0;
+    m_windowJobs = 0;
+    for (int c = 0; c < SizeClasses; ++c) {
+        m_windowLatency[c] = 0;
+        m_windowClassJobs[c] = 0;
+    }
+}
+
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
@@ -0,0 +1,100 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+
+#ifndef UPLOADCONCURRENCY_H
+#define UPLOADCONCURRENCY_H
+
+#include <QElapsedTimer>
+
+/**
+ * Decides how many jobs UploadJob may run at the same time.
+ *
+ * Completed transfers are collected in windows of about one round of jobs.
+ * When the bytes/s of a window improve over the previous one the limit is
+ * raised by one, when they drop or the latency of files of a similar size
+ * gets a lot worse it is lowered again. Errors halve the limit and lower the ceiling, so hosts
+ * that throttle connections are not hammered again in the next window.
+ */
+class UploadConcurrency
+{
+public:
+    enum {
+        MaximumLimit = 32 ///< never run more jobs than this
+    };
+
+    /**
+     * @param limit the number of jobs to start with
+     * @param ceiling the limit is only raised above this after some good windows
+     */
+    UploadConcurrency(int limit, int ceiling = MaximumLimit);
+
+    /**
+     * Returns how many jobs may run now
+     */
+    int limit() const {
+        return m_limit;
+    }
+
+    /**
+     * Caps the limit, eg. at the number of workers the jobs queue on.
+     * Jobs above it would only wait and make the others look slower.
+     */
+    void setMaximum(int maximum);
+
+    /**
+     * Returns the highest limit that did not cause trouble
+     */
+    int ceiling() const {
+        return m_ceiling;
+    }
+
+    /**
+     * Records a successfully finished file transfer. Directories, renames and
+     * deletions transfer nothing and would skew the windows, they are not recorded.
+     * @param bytes transferred bytes of the job
+     * @param msecs time from when a worker picked the job up to its result
+     */
+    void jobFinished(qulonglong bytes, qint64 msecs);
+
+    /**
+     * Records a job that failed because of a timeout or a refused or lost connection.
+     */
+    void jobFailed();
+
+private:
+    enum {
+        SizeClasses = 4 ///< latencies are only compared between files of about the same size
+    };
+
+    /**
+     * Returns the size class of a file, see sizeClassLimits
+     */
+    static int sizeClass(qulonglong bytes);
+
+    /**
+     * Compares the finished window with the previous one and adjusts the limit
+     */
+    void closeWindow();
+
+    int m_limit;
+    int m_ceiling;
+    int m_maximum; ///< the limit is never raised above it, see setMaximum()
+    int m_goodWindows; ///< windows in a row that improved while the limit was at the ceiling
+
+    QElapsedTimer m_window; ///< runs since the first job of the current window finished
+    qulonglong m_windowBytes;
+    int m_windowJobs;
+    qint64 m_windowLatency[SizeClasses]; ///< summed latency of the jobs in the current window by size class
+    int m_windowClassJobs[SizeClasses];
+
+    double m_lastThroughput; ///< bytes/ms of the previous window, 0 if there is none
+    double m_bestLatency[SizeClasses]; ///< lowest average latency of a window by size class, 0 if there is none
+};
+
+#endif
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
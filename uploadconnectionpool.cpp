@@ -0,0 +1,258 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+#include "uploadconnectionpool.h"
+
+#include <kio/scheduler.h>
+#include <kio/slave.h>
+#include <kio/simplejob.h>
+#include <kio/statjob.h>
+#include <kio/transferjob.h>
+
+#include <QIODevice>
+#include <QTimer>
+
+#include <KLocalizedString>
+
+#include "kdevuploaddebug.h"
+
+namespace {
+    const int idleTimeoutMsecs = 5 * 60 * 1000; ///< unused workers are disconnected after this
+    const int keepAliveMsecs = 60 * 1000; ///< shorter than the idle timeout of common ssh and ftp servers
+    const qint64 putChunkSize = 256 * 1024; ///< bytes sent per data request of a put job
+    const char* const readErrorProperty = "uploadReadError"; ///< set on a put job killed because its source failed
+}
+
+UploadConnectionPool::UploadConnectionPool(const QUrl& url, int size, QObject* parent)
+    : QObject(parent), m_size(qMax(1, size)), m_activeJobs(0)
+{
+    m_url = url.adjusted(QUrl::RemovePath | QUrl::RemoveQuery | QUrl::RemoveFragment);
+
+    m_idleTimer = new QTimer(this);
+    m_idleTimer->setSingleShot(true);
+    m_idleTimer->setInterval(idleTimeoutMsecs);
+    connect(m_idleTimer, SIGNAL(timeout()), this, SLOT(idleTimeout()));
+
+    m_keepAliveTimer = new QTimer(this);
+    m_keepAliveTimer->setInterval(keepAliveMsecs);
+    connect(m_keepAliveTimer, SIGNAL(timeout()), this, SLOT(keepAlive()));
+
+    KIO::Scheduler::connect(SIGNAL(slaveConnected(KIO::Slave*)),
+                            this, SLOT(slaveConnected(KIO::Slave*)));
+    KIO::Scheduler::connect(SIGNAL(slaveError(KIO::Slave*, int, QString)),
+                            this, SLOT(slaveError(KIO::Slave*, int, QString)));
+}
+
+UploadConnectionPool::~UploadConnectionPool()
+{
+    disconnectWorkers();
+}
+
+QString UploadConnectionPool::key(const QUrl& url)
+{
+    return url.adjusted(QUrl::RemovePath | QUrl::RemoveQuery | QUrl::RemoveFragment | QUrl::RemovePassword).toString();
+}
+
+void UploadConnectionPool::setSize(int size)
+{
+    m_size = qMax(1, size);
+    while (m_workers.count() > m_size) {
+        KIO::Slave* slave = m_workers.last();
+        removeWorker(slave);
+        KIO::Scheduler::disconnectSlave(slave);
+    }
+}
+
+void UploadConnectionPool::connectWorkers()
+{
+    if (m_url.isLocalFile()) return;
+
+    while (m_workers.count() < m_size) {
+        KIO::Slave* slave = KIO::Scheduler::getConnectedSlave(m_url);
+        if (!slave) {
+            qCWarning(KDEVUPLOAD) << "can't connect to" << m_url;
+            break;
+        }
+        qCDebug(KDEVUPLOAD) << "connecting worker" << m_workers.count() + 1 << "of" << m_size << "to" << m_url;
+        m_workers << slave;
+    }
+}
+
+void UploadConnectionPool::warmUp()
+{
+    if (m_url.isLocalFile()) return;
+
+    if (isWarm()) {
+        qCDebug(KDEVUPLOAD) << "connection is warm" << m_url;
+    } else {
+        qCDebug(KDEVUPLOAD) << "connection is cold, warming up" << m_url;
+    }
+    connectWorkers();
+    if (!m_activeJobs) {
+        m_idleTimer->start();
+    }
+    m_keepAliveTimer->start();
+}
+
+void UploadConnectionPool::disconnectWorkers()
+{
+    bool wasWarm = isWarm();
+    QList<KIO::Slave*> workers = m_workers;
+    m_workers.clear();
+    m_connected.clear();
+    m_workerJobs.clear();
+    m_keepAliveTimer->stop();
+    Q_FOREACH (KIO::Slave* slave, workers) {
+        KIO::Scheduler::disconnectSlave(slave);
+    }
+    if (wasWarm) {
+        emit warmthChanged(m_url, false);
+    }
+}
+
+void UploadConnectionPool::idleTimeout()
+{
+    qCDebug(KDEVUPLOAD) << "connection idle, disconnecting" << m_url;
+    disconnectWorkers();
+}
+
+KIO::TransferJob* UploadConnectionPool::put(QIODevice* source, const QUrl& dest, int permissions,
+                                            const QDateTime& modified)
+{
+    KIO::TransferJob* job = KIO::put(dest, permissions, KIO::Overwrite | KIO::HideProgressInfo);
+    job->setTotalSize(source->size());
+    //the chunks are sent by putData(), so a failed read can kill the job instead of ending the put
+    job->setAsyncDataEnabled(true);
+    if (modified.isValid()) {
+        //what FileCopyJob::setModificationTime() does for its put
+        job->addMetaData("modified", modified.toString(Qt::ISODate));
+    }
+    m_putSources.insert(job, source);
+    connect(job, SIGNAL(dataReq(KIO::Job*, QByteArray&)),
+            this, SLOT(putData(KIO::Job*, QByteArray&)));
+    connect(job, SIGNAL(finished(KJob*)),
+            this, SLOT(putFinished(KJob*)));
+    schedule(job);
+    return job;
+}
+
+void UploadConnectionPool::putData(KIO::Job* job, QByteArray& data)
+{
+    Q_UNUSED(data);
+    QIODevice* source = m_putSources.value(job);
+    if (!source) return;
+    KIO::TransferJob* transfer = static_cast<KIO::TransferJob*>(job);
+
+    QByteArray chunk(putChunkSize, Qt::Uninitialized);
+    qint64 read = source->read(chunk.data(), putChunkSize);
+    if (read < 0 || (read == 0 && !source->atEnd())) {
+        //an empty chunk ends the put, the server would keep a truncated file that looks uploaded
+        qCWarning(KDEVUPLOAD) << "can't read the source of" << transfer->url() << source->errorString();
+        transfer->setProperty(readErrorProperty, i18n("Cannot read the file uploaded to %1: %2",
+                                                      transfer->url().toDisplayString(), source->errorString()));
+        transfer->kill(KJob::EmitResult);
+        return;
+    }
+    chunk.resize(read);
+    transfer->sendAsyncData(chunk);
+}
+
+QString UploadConnectionPool::readError(KJob* job)
+{
+    return job->property(readErrorProperty).toString();
+}
+
+void UploadConnectionPool::putFinished(KJob* job)
+{
+    delete m_putSources.take(job);
+}
+
+void UploadConnectionPool::jobFinished(KJob* job)
+{
+    QHash<KIO::Slave*, int>::iterator it = m_workerJobs.find(m_jobWorkers.take(job));
+    if (it != m_workerJobs.end() && --it.value() <= 0) {
+        m_workerJobs.erase(it);
+    }
+    if (--m_activeJobs == 0) {
+        m_idleTimer->start();
+    }
+}
+
+void UploadConnectionPool::keepAlive()
+{
+    if (m_workers.isEmpty()) return;
+    KIO::SimpleJob* job = KIO::stat(m_url, KIO::StatJob::DestinationSide, 0, KIO::HideProgressInfo);
+    if (!KIO::Scheduler::assignJobToSlave(m_workers.first(), job)) {
+        //nothing to keep alive on a worker that is gone
+        job->kill(KJob::Quietly);
+    }
+}
+
+void UploadConnectionPool::schedule(KIO::SimpleJob* job)
+{
+    if (m_url.isLocalFile()) return;
+
+    connectWorkers();
+    if (m_workers.isEmpty()) return;
+
+    //a worker runs its jobs one after the other, take the one with the fewest
+    KIO::Slave* slave = nullptr;
+    Q_FOREACH (KIO::Slave* worker, m_workers) {
+        if (!slave || m_workerJobs.value(worker) < m_workerJobs.value(slave)) {
+            slave = worker;
+        }
+    }
+    if (!KIO::Scheduler::assignJobToSlave(slave, job)) {
+        //the worker died, requeue the job so the scheduler runs it on a worker of its own
+        qCDebug(KDEVUPLOAD) << "can't assign job to worker, falling back to the scheduler" << job->url();
+        removeWorker(slave);
+        KIO::Scheduler::disconnectSlave(slave);
+        KIO::Scheduler::setJobPriority(job, 1);
+        return;
+    }
+
+    ++m_activeJobs;
+    ++m_workerJobs[slave];
+    m_jobWorkers.insert(job, slave);
+    //finished is emitted for killed jobs too
+    connect(job, SIGNAL(finished(KJob*)), this, SLOT(jobFinished(KJob*)));
+    m_idleTimer->stop();
+    m_keepAliveTimer->start();
+}
+
+void UploadConnectionPool::slaveConnected(KIO::Slave* slave)
+{
+    if (!m_workers.contains(slave)) return;
+    bool wasWarm = isWarm();
+    m_connected.insert(slave);
+    if (!wasWarm) {
+        emit warmthChanged(m_url, true);
+    }
+    emit workerConnected();
+}
+
+void UploadConnectionPool::slaveError(KIO::Slave* slave, int error, const QString& errorMsg)
+{
+    if (!m_workers.contains(slave)) return;
+    //connected again by the next job
+    qCDebug(KDEVUPLOAD) << "worker error" << m_url << error << errorMsg;
+    removeWorker(slave);
+    KIO::Scheduler::disconnectSlave(slave);
+}
+
+void UploadConnectionPool::removeWorker(KIO::Slave* slave)
+{
+    bool wasWarm = isWarm();
+    m_workers.removeAll(slave);
+    m_connected.remove(slave);
+    m_workerJobs.remove(slave);
+    if (wasWarm && !isWarm()) {
+        emit warmthChanged(m_url, false);
+    }
+}
+
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
@@ -0,0 +1,181 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+
+#ifndef UPLOADCONNECTIONPOOL_H
+#define UPLOADCONNECTIONPOOL_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QUrl>
+
+class QTimer;
+class QIODevice;
+class KJob;
+
+namespace KIO {
+    class Job;
+    class Slave;
+    class SimpleJob;
+    class TransferJob;
+}
+
+/**
+ * Connected KIO workers for the server of an upload profile.
+ *
+ * Jobs scheduled through the pool are assigned to one of the workers, so
+ * sftp or ftp uploads log in once per session instead of once per job.
+ * Local destinations don't need a connection, their jobs are scheduled
+ * as usual.
+ *
+ * The workers are kept alive while the pool is in use and disconnected
+ * after it was idle for a while.
+ */
+class UploadConnectionPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @param url any url on the server, only protocol, host, port and user are used
+     * @param size number of workers to connect
+     */
+    UploadConnectionPool(const QUrl& url, int size, QObject* parent = nullptr);
+    ~UploadConnectionPool() override;
+
+    /**
+     * Returns the key of the server of url, profiles with the same key share a pool
+     */
+    static QString key(const QUrl& url);
+
+    QUrl url() const {
+        return m_url;
+    }
+
+    int size() const {
+        return m_size;
+    }
+
+    /**
+     * Sets the number of workers, surplus workers are disconnected
+     */
+    void setSize(int size);
+
+    /**
+     * Connects workers until there are size() of them
+     */
+    void connectWorkers();
+
+    /**
+     * Connects the workers in the background, so the next job doesn't wait for the login.
+     * Restarts the idle timeout.
+     */
+    void warmUp();
+
+    /**
+     * Disconnects all workers, they are connected again when the next job is scheduled
+     */
+    void disconnectWorkers();
+
+    /**
+     * Returns true if at least one worker is connected
+     */
+    bool isWarm() const {
+        return !m_connected.isEmpty();
+    }
+
+    /**
+     * Returns the number of workers that finished connecting
+     */
+    int connectedCount() const {
+        return m_connected.count();
+    }
+
+    /**
+     * Runs job on the worker with the fewest running jobs.
+     * A worker runs its jobs one after the other, so more jobs than size()
+     * wait for each other. Call it right after creating the job. If the worker doesn't take it,
+     * the job is left to the scheduler and runs on a worker of its own.
+     */
+    void schedule(KIO::SimpleJob* job);
+
+    /**
+     * Starts a put job on one of the workers that writes the content of source to dest.
+     * KIO::file_copy can't be bound to a worker, this is used for copies instead.
+     * @param source an open device, deleted when the job finished
+     * @param permissions mode of the written file, -1 to leave it to the server
+     * @param modified modification time of the written file, invalid to leave it to the server
+     */
+    KIO::TransferJob* put(QIODevice* source, const QUrl& dest, int permissions = -1,
+                          const QDateTime& modified = QDateTime());
+
+    /**
+     * Returns why a job started by put() failed to read its source, empty if it didn't.
+     * Such a job is killed, so its error() is KIO::ERR_USER_CANCELED although the user didn't cancel.
+     */
+    static QString readError(KJob* job);
+
+Q_SIGNALS:
+    /**
+     * Emitted when a worker finished connecting
+     */
+    void workerConnected();
+
+    /**
+     * Emitted when the first worker is connected or the last one is gone
+     */
+    void warmthChanged(const QUrl& url, bool warm);
+
+private Q_SLOTS:
+    void slaveConnected(KIO::Slave* slave);
+    void slaveError(KIO::Slave* slave, int error, const QString& errorMsg);
+
+    /**
+     * Disconnects the workers after the pool was idle for the idle timeout
+     */
+    void idleTimeout();
+
+    /**
+     * Starts the idle timeout when the last job of the pool finished
+     */
+    void jobFinished(KJob* job);
+
+    /**
+     * Sends the next chunk of the source of a put job, kills the job if the source can't be read
+     */
+    void putData(KIO::Job* job, QByteArray& data);
+
+    /**
+     * Deletes the source of a put job
+     */
+    void putFinished(KJob* job);
+
+    /**
+     * Sends a stat to the server, so it doesn't close idle connections before our timeout does
+     */
+    void keepAlive();
+
+private:
+    void removeWorker(KIO::Slave* slave);
+
+    QUrl m_url; ///< root of the server, without path
+    int m_size;
+    QList<KIO::Slave*> m_workers; ///< connecting and connected workers
+    QSet<KIO::Slave*> m_connected; ///< workers that finished connecting
+    int m_activeJobs; ///< jobs scheduled on the workers that are not finished
+    QHash<KIO::Slave*, int> m_workerJobs; ///< number of unfinished jobs by worker, workers without jobs are left out
+    QHash<KJob*, KIO::Slave*> m_jobWorkers; ///< worker of each unfinished job
+    QTimer* m_idleTimer; ///< runs while no job is active
+    QTimer* m_keepAliveTimer;
+    QHash<KJob*, QIODevice*> m_putSources; ///< what the running put jobs send
+};
+
+#endif
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
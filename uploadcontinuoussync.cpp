@@ -0,0 +1,210 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+#include "uploadcontinuoussync.h"
+
+#include <QStandardItemModel>
+#include <QTimer>
+
+#include <KLocalizedString>
+#include <kconfiggroup.h>
+#include <kparts/mainwindow.h>
+
+#include <interfaces/icore.h>
+#include <interfaces/idocument.h>
+#include <interfaces/idocumentcontroller.h>
+#include <interfaces/iproject.h>
+#include <interfaces/iuicontroller.h>
+#include <project/projectmodel.h>
+#include <serialization/indexedstring.h>
+
+#include "kdevuploaddebug.h"
+#include "kdevuploadplugin.h"
+#include "uploadjob.h"
+#include "uploadprojectwatch.h"
+#include "uploadprojectmodel.h"
+
+namespace {
+    const int quietMsecs = 2000; ///< changes are uploaded when nothing changed for this long
+    const int maximumDelayMsecs = 10000; ///< a change doesn't wait longer than this, even if more keep coming
+}
+
+UploadContinuousSync::UploadContinuousSync(UploadPlugin* plugin, KDevelop::IProject* project, QObject* parent)
+    : QObject(parent), m_plugin(plugin), m_project(project), m_watching(false)
+{
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setSingleShot(true);
+    connect(m_flushTimer, SIGNAL(timeout()), this, SLOT(flush()));
+
+    connect(KDevelop::ICore::self()->documentController(), SIGNAL(documentSaved(KDevelop::IDocument*)),
+            this, SLOT(documentSaved(KDevelop::IDocument*)));
+
+    update();
+}
+
+UploadContinuousSync::~UploadContinuousSync()
+{
+    //running sessions finish on their own
+    Q_FOREACH (const ProfileSync& sync, m_syncs) {
+        if (sync.job) {
+            sync.job->disconnect(this);
+        }
+    }
+}
+
+void UploadContinuousSync::update()
+{
+    m_profiles.clear();
+    KConfigGroup group = m_project->projectConfiguration()->group("Upload");
+    Q_FOREACH (const QString& g, group.groupList()) {
+        if (g.startsWith("Profile") && group.group(g).readEntry("continuousSync", false)) {
+            m_profiles << g;
+        }
+    }
+
+    //forget the queues of profiles that stopped syncing, a running session still ends normally
+    QMutableHashIterator<QString, ProfileSync> i(m_syncs);
+    while (i.hasNext()) {
+        i.next();
+        if (!m_profiles.contains(i.key())) {
+            i.value().pending.clear();
+            if (!i.value().job) {
+                i.remove();
+            }
+        }
+    }
+
+    UploadProjectWatch* watch = UploadProjectWatch::forProject(m_project);
+    if (!m_profiles.isEmpty() && !m_watching) {
+        qCDebug(KDEVUPLOAD) << "continuous sync, watching" << m_project->path() << m_profiles;
+        watch->addUser(this);
+        connect(watch, SIGNAL(fileChanged(QString)), this, SLOT(fileChanged(QString)));
+        m_watching = true;
+    } else if (m_profiles.isEmpty() && m_watching) {
+        qCDebug(KDEVUPLOAD) << "continuous sync stopped" << m_project->path();
+        disconnect(watch, SIGNAL(fileChanged(QString)), this, SLOT(fileChanged(QString)));
+        watch->removeUser(this);
+        m_watching = false;
+    }
+    scheduleFlush();
+}
+
+void UploadContinuousSync::documentSaved(KDevelop::IDocument* document)
+{
+    if (document->url().isLocalFile()) {
+        fileChanged(document->url().toLocalFile());
+    }
+}
+
+void UploadContinuousSync::fileChanged(const QString& path)
+{
+    if (m_profiles.isEmpty()) return;
+    //directories, build output and files hidden by the project filters aren't uploaded
+    if (m_project->filesForPath(KDevelop::IndexedString(path)).isEmpty()) return;
+
+    Q_FOREACH (const QString& profile, m_profiles) {
+        ProfileSync& sync = m_syncs[profile];
+        if (sync.pending.isEmpty()) {
+            sync.firstChange.start();
+        }
+        sync.pending.insert(path);
+        sync.lastChange.start();
+    }
+    scheduleFlush();
+}
+
+void UploadContinuousSync::scheduleFlush()
+{
+    qint64 delay = -1;
+    QHashIterator<QString, ProfileSync> i(m_syncs);
+    while (i.hasNext()) {
+        i.next();
+        const ProfileSync& sync = i.value();
+        if (sync.pending.isEmpty() || sync.job) continue;
+        qint64 remaining = qMin(quietMsecs - sync.lastChange.elapsed(), maximumDelayMsecs - sync.firstChange.elapsed());
+        remaining = qMax(Q_INT64_C(0), remaining);
+        if (delay == -1 || remaining < delay) {
+            delay = remaining;
+        }
+    }
+    if (delay == -1) {
+        m_flushTimer->stop();
+    } else {
+        m_flushTimer->start(static_cast<int>(delay));
+    }
+}
+
+void UploadContinuousSync::flush()
+{
+    QStringList due;
+    QHashIterator<QString, ProfileSync> i(m_syncs);
+    while (i.hasNext()) {
+        i.next();
+        const ProfileSync& sync = i.value();
+        if (sync.pending.isEmpty() || sync.job) continue;
+        if (sync.lastChange.elapsed() >= quietMsecs || sync.firstChange.elapsed() >= maximumDelayMsecs) {
+            due << i.key();
+        }
+    }
+    Q_FOREACH (const QString& profile, due) {
+        startSession(profile);
+    }
+    scheduleFlush();
+}
+
+void UploadContinuousSync::startSession(const QString& profileGroup)
+{
+    KConfigGroup profile = m_project->projectConfiguration()->group("Upload").group(profileGroup);
+    ProfileSync& sync = m_syncs[profileGroup];
+    QList<QUrl> files;
+    Q_FOREACH (const QString& path, sync.pending) {
+        files << QUrl::fromLocalFile(path);
+    }
+    sync.pending.clear();
+
+    UploadProjectModel* model = new UploadProjectModel(m_project);
+    model->setSourceModel(m_project->projectItem()->model());
+    model->setProfileConfigGroup(profile);
+
+    QStandardItemModel* outputModel = m_plugin->outputModel();
+    if (outputModel) {
+        outputModel->appendRow(new QStandardItem(i18np("Syncing 1 changed file to %2",
+                                                       "Syncing %1 changed files to %2",
+                                                       files.count(), profile.readEntry("name", QString()))));
+    }
+
+    UploadJob* job = new UploadJob(m_project, model, KDevelop::ICore::self()->uiController()->activeMainWindow());
+    model->setParent(job);
+    job->setFiles(files);
+    //partial upload: no log for unmodified files and no garbage collection
+    job->setQuickUpload(true);
+    job->setShowProgress(false);
+    job->setConnectionPool(m_plugin->connectionPool(profile));
+    job->setOutputModel(outputModel);
+    sync.job = job;
+    connect(job, SIGNAL(destroyed(QObject*)), this, SLOT(sessionEnded(QObject*)));
+    job->start();
+}
+
+void UploadContinuousSync::sessionEnded(QObject* job)
+{
+    QMutableHashIterator<QString, ProfileSync> i(m_syncs);
+    while (i.hasNext()) {
+        i.next();
+        if (i.value().job == job) {
+            i.value().job = nullptr;
+            if (!m_profiles.contains(i.key())) {
+                i.remove();
+            }
+            break;
+        }
+    }
+    //changes that came in during the session are due now
+    scheduleFlush();
+}
+
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
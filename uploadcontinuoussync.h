@@ -0,0 +1,108 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+
+#ifndef UPLOADCONTINUOUSSYNC_H
+#define UPLOADCONTINUOUSSYNC_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QUrl>
+
+class QTimer;
+namespace KDevelop {
+    class IProject;
+    class IDocument;
+}
+class UploadPlugin;
+class UploadJob;
+
+/**
+ * Continuous sync of a project to the profiles that have it enabled.
+ *
+ * Watches the project directory and saved documents and queues the changed
+ * files. Changes are coalesced until nothing changed for a short while, so a
+ * burst of saves or a build that rewrites many files becomes one upload
+ * session per profile. A file that changes again while it is queued is
+ * queued once. While a session of a profile runs new changes wait for it,
+ * there is never more than one session per profile.
+ */
+class UploadContinuousSync : public QObject
+{
+    Q_OBJECT
+
+public:
+    UploadContinuousSync(UploadPlugin* plugin, KDevelop::IProject* project, QObject* parent = nullptr);
+    ~UploadContinuousSync() override;
+
+    /**
+     * Reads which profiles of the project have continuous sync enabled,
+     * starts or stops watching the project directory accordingly
+     */
+    void update();
+
+    /**
+     * Returns true if at least one profile has continuous sync enabled
+     */
+    bool isActive() const {
+        return !m_profiles.isEmpty();
+    }
+
+public Q_SLOTS:
+    /**
+     * Queues a changed file for all profiles with continuous sync
+     */
+    void fileChanged(const QString& path);
+
+private Q_SLOTS:
+    void documentSaved(KDevelop::IDocument* document);
+
+    /**
+     * Starts the sessions of the profiles whose debounce window elapsed
+     */
+    void flush();
+
+    /**
+     * Called when the session of a profile is gone, starts the next one if changes are queued
+     */
+    void sessionEnded(QObject* job);
+
+private:
+    /**
+     * Queued changes and running session of a profile
+     */
+    struct ProfileSync {
+        ProfileSync() : job(nullptr) {}
+        QSet<QString> pending; ///< changed local files, each file once
+        QElapsedTimer firstChange; ///< time since the oldest queued change
+        QElapsedTimer lastChange; ///< time since the newest queued change
+        UploadJob* job; ///< running session, nullptr if there is none
+    };
+
+    /**
+     * Starts an upload session for the queued files of a profile
+     */
+    void startSession(const QString& profileGroup);
+
+    /**
+     * Starts the timer for the next profile that has queued changes and no session
+     */
+    void scheduleFlush();
+
+    UploadPlugin* m_plugin;
+    KDevelop::IProject* m_project;
+    QStringList m_profiles; ///< config groups of the profiles with continuous sync
+    QHash<QString, ProfileSync> m_syncs; ///< state by profile config group
+    bool m_watching; ///< if the project watch is used, while a profile syncs
+    QTimer* m_flushTimer;
+};
+
+#endif
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
@@ -14,6 +14,7 @@
 #include <QProgressDialog>
 #include <QMenu>
 #include <QContextMenuEvent>
+#include <QStandardItemModel>
 
 #include <KLocalizedString>
 
@@ -38,9 +39,12 @@
 #include "uploadprofiledlg.h"
 #include "uploadjob.h"
 #include "kdevuploadplugin.h"
+#include "uploadconnectionpool.h"
+#include "uploadremotesnapshot.h"
 
 UploadDialog::UploadDialog(KDevelop::IProject* project, UploadPlugin* plugin, QWidget *parent)
-    : QDialog(parent), m_project(project), m_profileModel(nullptr), m_editProfileDlg(nullptr), m_plugin(plugin)
+    : QDialog(parent), m_project(project), m_profileModel(nullptr), m_editProfileDlg(nullptr), m_plugin(plugin),
+      m_remoteSnapshot(nullptr)
 {
     m_ui = new Ui::UploadDialog();
     m_ui->setupUi(this);
@@ -48,11 +52,21 @@ UploadDialog::UploadDialog(KDevelop::IProject* project, UploadPlugin* plugin, QW
     m_ui->buttonBox->button(QDialogButtonBox::Ok)->setText(i18n("&Upload"));
     connect(m_ui->buttonBox->button(QDialogButtonBox::Ok), SIGNAL(clicked()),
             this, SLOT(startUpload()));
+    QPushButton* dryRunButton = m_ui->buttonBox->addButton(i18n("&Dry Run"), QDialogButtonBox::ActionRole);
+    connect(dryRunButton, SIGNAL(clicked()),
+            this, SLOT(dryRun()));
+    m_compareButton = m_ui->buttonBox->addButton(i18n("&Compare with Remote"), QDialogButtonBox::ActionRole);
+    connect(m_compareButton, SIGNAL(clicked()),
+            this, SLOT(compareWithRemote()));
 
     m_uploadProjectModel = new UploadProjectModel(project);
     m_uploadProjectModel->setSourceModel(project->projectItem()->model());
     m_ui->projectTree->setModel(m_uploadProjectModel);
     m_ui->projectTree->header()->hide();
+    connect(m_ui->projectTree, SIGNAL(expanded(QModelIndex)),
+            this, SLOT(treeExpanded(QModelIndex)));
+    connect(m_ui->projectTree, SIGNAL(collapsed(QModelIndex)),
+            this, SLOT(treeCollapsed(QModelIndex)));
 
     connect(m_ui->profileCombobox, SIGNAL(currentIndexChanged(int)),
             this, SLOT(profileChanged(int)));
@@ -61,7 +75,8 @@ UploadDialog::UploadDialog(KDevelop::IProject* project, UploadPlugin* plugin, QW
 
     connect(m_ui->modifyProfileButton, SIGNAL(clicked()),
             this, SLOT(modifyProfile()));
-
+    connect(m_ui->rememberSelectionCheckBox, SIGNAL(toggled(bool)),
+            this, SLOT(rememberSelectionToggled(bool)));
 
     m_treeContextMenu = new QMenu(this);
     QAction* action = new QAction(i18nc("Select all items in the tree", "All"), this);
@@ -81,6 +96,7 @@ UploadDialog::UploadDialog(KDevelop::IProject* project, UploadPlugin* plugin, QW
 
 UploadDialog::~UploadDialog()
 {
+    m_uploadProjectModel->saveCheckStates();
     delete m_ui;
     delete m_editProfileDlg;
 }
@@ -100,17 +116,29 @@ void UploadDialog::modifyProfile()
 
 void UploadDialog::profileChanged(int index)
 {
+    //a comparison with the old destination is useless
+    delete m_remoteSnapshot;
+    m_remoteSnapshot = nullptr;
+    m_compareButton->setEnabled(true);
+
     UploadProfileItem* i = m_profileModel->uploadItem(index);
     if (i) {
         KConfigGroup c = i->profileConfigGroup();
         if (c.isValid()) {
             m_uploadProjectModel->setProfileConfigGroup(c);
+            UploadConnectionPool* pool = m_plugin->connectionPool(c);
+            if (pool) {
+                pool->warmUp();
+            }
+            m_ui->rememberSelectionCheckBox->setChecked(m_uploadProjectModel->rememberCheckStates());
+            m_ui->rememberSelectionCheckBox->setEnabled(true);
             m_ui->projectTree->setEnabled(true);
             m_ui->buttonBox->button(QDialogButtonBox::Ok)->setEnabled(true);
             return;
         }
     }
     m_ui->projectTree->setEnabled(false);
+    m_ui->rememberSelectionCheckBox->setEnabled(false);
     m_ui->buttonBox->button(QDialogButtonBox::Ok)->setEnabled(false);
 }
 
@@ -124,12 +152,78 @@ void UploadDialog::startUpload()
     UploadJob* job = new UploadJob(m_project, m_uploadProjectModel, this);
     connect(job, SIGNAL(uploadFinished()), this, SLOT(uploadFinished()));
     job->setOnlyMarkUploaded(m_ui->markUploadedCheckBox->checkState() == Qt::Checked);
+    job->setConnectionPool(m_plugin->connectionPool(m_uploadProjectModel->profileConfigGroup()));
     job->setOutputModel(m_plugin->outputModel());
     job->start();
 }
 
+void UploadDialog::dryRun()
+{
+    if (m_ui->profileCombobox->currentIndex() == -1) {
+        KMessageBox::sorry(this, i18n("Cannot upload, no profile selected."));
+        return;
+    }
+    UploadJob* job = new UploadJob(m_project, m_uploadProjectModel, this);
+    job->setDryRun(true);
+    job->setOutputModel(m_plugin->outputModel());
+    job->start();
+}
+
+void UploadDialog::rememberSelectionToggled(bool checked)
+{
+    m_uploadProjectModel->setRememberCheckStates(checked);
+}
+
+void UploadDialog::compareWithRemote()
+{
+    if (m_ui->profileCombobox->currentIndex() == -1) {
+        KMessageBox::sorry(this, i18n("Cannot compare, no profile selected."));
+        return;
+    }
+    KConfigGroup profile = m_uploadProjectModel->profileConfigGroup();
+    delete m_remoteSnapshot;
+    m_remoteSnapshot = new UploadRemoteSnapshot(m_project, profile, this);
+    m_remoteSnapshot->setConnectionPool(m_plugin->connectionPool(profile));
+    connect(m_remoteSnapshot, SIGNAL(finished(bool)), this, SLOT(remoteCompared(bool)));
+    appendLog(i18n("Comparing with %1...", m_uploadProjectModel->currentProfileUrl().toDisplayString()));
+    m_compareButton->setEnabled(false);
+    m_remoteSnapshot->start();
+}
+
+void UploadDialog::remoteCompared(bool success)
+{
+    m_compareButton->setEnabled(true);
+    if (!success) {
+        KMessageBox::sorry(this, i18n("Cannot list %1: %2", m_uploadProjectModel->currentProfileUrl().toDisplayString(),
+                                      m_remoteSnapshot->errorString()));
+    } else {
+        QSet<QString> differences = m_remoteSnapshot->differences();
+        appendLog(i18np("1 file differs from %2", "%1 files differ from %2", differences.count(),
+                        m_uploadProjectModel->currentProfileUrl().toDisplayString()));
+        m_uploadProjectModel->checkFiles(differences, m_remoteSnapshot->compared());
+        QStringList remoteOnly = m_remoteSnapshot->remoteOnly();
+        if (!remoteOnly.isEmpty()) {
+            appendLog(i18np("1 item in %2 doesn't exist locally", "%1 items in %2 don't exist locally", remoteOnly.count(),
+                            m_uploadProjectModel->currentProfileUrl().toDisplayString()));
+        }
+        m_uploadProjectModel->setRemoteOnly(remoteOnly);
+    }
+    m_remoteSnapshot->deleteLater();
+    m_remoteSnapshot = nullptr;
+}
+
+void UploadDialog::appendLog(const QString& message)
+{
+    QStandardItemModel* outputModel = m_plugin->outputModel();
+    if (outputModel) {
+        outputModel->appendRow(new QStandardItem(message));
+    }
+}
+
 void UploadDialog::uploadFinished()
 {
+    // everything selected is uploaded now, don't restore a stale selection next time
+    m_uploadProjectModel->checkModified();
     hide();
 }
 
@@ -145,6 +239,16 @@ void UploadDialog::setRootItem(KDevelop::ProjectBaseItem* item)
     }
 }
 
+void UploadDialog::treeExpanded(const QModelIndex& index)
+{
+    m_uploadProjectModel->setExpanded(index, true);
+}
+
+void UploadDialog::treeCollapsed(const QModelIndex& index)
+{
+    m_uploadProjectModel->setExpanded(index, false);
+}
+
 bool UploadDialog::eventFilter(QObject* obj, QEvent* event)
 {
     if (event->type() == QEvent::ContextMenu) {
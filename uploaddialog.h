@@ -17,6 +17,7 @@
 class QAbstractButton;
 class QProgressDialog;
 class QMenu;
+class QPushButton;
 class KJob;
 namespace KDevelop {
     class IProject;
@@ -26,6 +27,7 @@ class UploadProjectModel;
 class UploadProfileModel;
 class UploadProfileDlg;
 class UploadPlugin;
+class UploadRemoteSnapshot;
 namespace Ui {
     class UploadDialog;
 }
@@ -57,6 +59,21 @@ private Q_SLOTS:
      */
     void startUpload();
 
+    /**
+     * Logs what the upload would do, without uploading
+     */
+    void dryRun();
+
+    /**
+     * Lists the destination of the current profile and checks the files that differ from it
+     */
+    void compareWithRemote();
+
+    /**
+     * Called when the comparison with the destination is done
+     */
+    void remoteCompared(bool success);
+
     /**
      * Current profile changed, sets the new profile to the model
      */
@@ -67,11 +84,26 @@ private Q_SLOTS:
      */
     void modifyProfile();
 
+    /**
+     * Stores in the current profile whether the selection is kept between dialog sessions
+     */
+    void rememberSelectionToggled(bool checked);
+
     /**
      * Called when the upload successfully finished, closes the UploadDialog
      */
     void uploadFinished();
 
+    /**
+     * A folder was expanded in the tree, its children get their real check states
+     */
+    void treeExpanded(const QModelIndex& index);
+
+    /**
+     * A folder was collapsed in the tree, it shows a summary again
+     */
+    void treeCollapsed(const QModelIndex& index);
+
 protected:
     /**
      * Event-filter for tree context-menu.
@@ -79,6 +111,11 @@ protected:
     bool eventFilter(QObject* obj, QEvent* event) override;
 
 private:
+    /**
+     * Adds a line to the output view of the plugin
+     */
+    void appendLog(const QString& message);
+
     Ui::UploadDialog* m_ui;
     KDevelop::IProject* m_project;
     UploadProjectModel* m_uploadProjectModel;
@@ -86,6 +123,8 @@ private:
     UploadProfileDlg* m_editProfileDlg;
     UploadPlugin* m_plugin;
     QMenu* m_treeContextMenu;
+    QPushButton* m_compareButton;
+    UploadRemoteSnapshot* m_remoteSnapshot; ///< running comparison with the destination
 };
 
 
@@ -0,0 +1,309 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+#include "uploaddirtyset.h"
+
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+#include <QTimer>
+
+#include <interfaces/iproject.h>
+#include <project/projectmodel.h>
+#include <util/path.h>
+
+#include "kdevuploaddebug.h"
+#include "uploadprojectwatch.h"
+#include "uploadstatestore.h"
+
+namespace {
+    const int scanBatchSize = 256; ///< files handed to a worker at once, results come back per batch
+    const int recheckDelay = 100; ///< msecs to collect changes before they are checked
+
+    /**
+     * Checks a batch of files on a worker thread
+     */
+    class ScanTask : public QRunnable
+    {
+    public:
+        ScanTask(const QVector<UploadDirtySet::ScanItem>& items, UploadDirtySet* set)
+            : m_items(items), m_set(set) {}
+
+        void run() override
+        {
+            QVector<UploadDirtySet::ScanResult> results;
+            results.reserve(m_items.count());
+            Q_FOREACH (const UploadDirtySet::ScanItem& item, m_items) {
+                UploadDirtySet::ScanResult result;
+                result.file = item.file;
+                result.path = item.path;
+                result.modified = false;
+                result.generation = item.generation;
+                if (QFileInfo(item.localFile).isFile()) {
+                    result.modified = UploadStateStore::isModified(item.recorded, item.uploadTime,
+                                                                   item.localFile, &result.touched);
+                    if (!result.modified && item.recorded.isValid() && !item.recorded.hasHash()) {
+                        //recorded without hash, eg. marked as uploaded: hash it now that we are on a worker
+                        UploadFingerprint hashed = UploadFingerprint::fromUploadedFile(item.localFile, item.recorded);
+                        if (hashed.hasHash()) {
+                            result.touched = hashed;
+                        }
+                    }
+                }
+                results << result;
+            }
+            m_set->addResults(results);
+        }
+
+    private:
+        QVector<UploadDirtySet::ScanItem> m_items;
+        UploadDirtySet* m_set; ///< waits for the workers before it is deleted
+    };
+}
+
+UploadDirtySet* UploadDirtySet::forProfile(KDevelop::IProject* project, const KConfigGroup& profile)
+{
+    UploadDirtySet* set = project->findChild<UploadDirtySet*>(profile.name(), Qt::FindDirectChildrenOnly);
+    if (!set) {
+        set = new UploadDirtySet(project, profile, project);
+        set->setObjectName(profile.name());
+    }
+    return set;
+}
+
+void UploadDirtySet::discard(KDevelop::IProject* project, const QString& profileGroup)
+{
+    delete project->findChild<UploadDirtySet*>(profileGroup, Qt::FindDirectChildrenOnly);
+}
+
+UploadDirtySet::UploadDirtySet(KDevelop::IProject* project, const KConfigGroup& profile, QObject* parent)
+    : QObject(parent), m_project(project), m_checking(false)
+{
+    m_workers.setMaxThreadCount(QThread::idealThreadCount());
+
+    m_stateStore = UploadStateStore::forProfile(project, profile);
+    connect(m_stateStore, SIGNAL(entriesChanged(QStringList)),
+            this, SLOT(entriesChanged(QStringList)));
+
+    m_recheckTimer = new QTimer(this);
+    m_recheckTimer->setSingleShot(true);
+    m_recheckTimer->setInterval(recheckDelay);
+    connect(m_recheckTimer, SIGNAL(timeout()), this, SLOT(recheck()));
+
+    UploadProjectWatch* watch = UploadProjectWatch::forProject(project);
+    watch->addUser(this);
+    connect(watch, SIGNAL(fileChanged(QString)), this, SLOT(fileChanged(QString)));
+    connect(watch, SIGNAL(fileDeleted(QString)), this, SLOT(fileChanged(QString)));
+    //files created later are in the project once its manager picked them up, often after the watch fired
+    connect(project->projectItem()->model(), SIGNAL(rowsInserted(QModelIndex, int, int)),
+            this, SLOT(rowsInserted(QModelIndex, int, int)));
+
+    m_unscanned = project->fileSet();
+    m_scanQueue = m_unscanned.toList();
+    qCDebug(KDEVUPLOAD) << "scanning" << m_scanQueue.count() << "files for" << profile.name();
+    QTimer::singleShot(0, this, SLOT(scanBatch()));
+}
+
+UploadDirtySet::~UploadDirtySet()
+{
+    //the workers call addResults()
+    m_workers.clear();
+    m_workers.waitForDone();
+}
+
+bool UploadDirtySet::isModified(const QString& path, const QString& localFile)
+{
+    KDevelop::IndexedString file(localFile);
+    if (!isScanned(file)) {
+        //counts as modified until the workers checked it, queued once
+        if (!isScanning(file) && !m_generations.contains(path)) {
+            queueRecheck(path);
+        }
+        return true;
+    }
+    return m_dirty.contains(path);
+}
+
+UploadDirtySet::ScanItem UploadDirtySet::scanItem(const KDevelop::IndexedString& file, const QString& path)
+{
+    ScanItem item;
+    item.file = file.index();
+    item.path = path;
+    item.localFile = file.str();
+    item.generation = ++m_generations[path];
+    item.recorded = m_stateStore->fingerprint(path);
+    if (!item.recorded.isValid()) {
+        item.uploadTime = m_stateStore->uploadTime(path);
+    }
+    return item;
+}
+
+void UploadDirtySet::scanBatch()
+{
+    //the lookups in the state store stay on this thread, the workers only touch the files
+    QVector<ScanItem> items;
+    while (items.count() < scanBatchSize && !m_scanQueue.isEmpty()) {
+        KDevelop::IndexedString file = m_scanQueue.takeFirst();
+        items << scanItem(file, m_project->path().relativePath(KDevelop::Path(file.str())));
+    }
+    if (!items.isEmpty()) {
+        m_workers.start(new ScanTask(items, this));
+    }
+    if (!m_scanQueue.isEmpty()) {
+        QTimer::singleShot(0, this, SLOT(scanBatch()));
+    } else if (isReady()) {
+        //the project has no files
+        emit ready();
+    }
+}
+
+void UploadDirtySet::addResults(const QVector<ScanResult>& results)
+{
+    QMutexLocker lock(&m_resultsMutex);
+    bool first = m_results.isEmpty();
+    m_results += results;
+    if (first) {
+        //later batches are taken along, until applyResults ran
+        QMetaObject::invokeMethod(this, "applyResults", Qt::QueuedConnection);
+    }
+}
+
+void UploadDirtySet::applyResults()
+{
+    QVector<ScanResult> results;
+    {
+        QMutexLocker lock(&m_resultsMutex);
+        results.swap(m_results);
+    }
+
+    bool wasReady = isReady();
+    QList<KDevelop::IndexedString> changed;
+    QStringList touchedPaths;
+    QList<UploadFingerprint> touched;
+    Q_FOREACH (const ScanResult& result, results) {
+        //the file changed or was queued again since, a newer result follows
+        if (result.generation != m_generations.value(result.path)) continue;
+        KDevelop::IndexedString file = KDevelop::IndexedString::fromIndex(result.file);
+        //a first result replaces the placeholder, even if it says the same as before
+        bool scanned = m_unscanned.remove(file) || !m_scanned.contains(file);
+        m_scanned.insert(file);
+        if (setModified(result.path, result.modified) || scanned) {
+            changed << file;
+        }
+        if (result.touched.isValid()) {
+            touchedPaths << result.path;
+            touched << result.touched;
+        }
+    }
+
+    if (!touched.isEmpty()) {
+        //touched files get their new stat recorded, that isn't a change we need to check
+        m_checking = true;
+        m_stateStore->setFingerprints(touchedPaths, touched);
+        m_checking = false;
+    }
+    if (!changed.isEmpty()) {
+        emit this->changed(changed);
+    }
+    if (!wasReady && isReady()) {
+        qCDebug(KDEVUPLOAD) << "scan done," << m_dirty.count() << "modified files for" << objectName();
+        emit ready();
+    }
+}
+
+bool UploadDirtySet::setModified(const QString& path, bool modified)
+{
+    if (modified == m_dirty.contains(path)) return false;
+    if (modified) {
+        m_dirty.insert(path);
+    } else {
+        m_dirty.remove(path);
+    }
+
+    //all directories above the file, up to the project directory
+    QString directory = path;
+    do {
+        int slash = directory.lastIndexOf('/');
+        directory = slash == -1 ? QString() : directory.left(slash);
+        if (modified) {
+            ++m_dirtyDirectories[directory];
+        } else if (--m_dirtyDirectories[directory] <= 0) {
+            m_dirtyDirectories.remove(directory);
+        }
+    } while (!directory.isEmpty());
+    return true;
+}
+
+void UploadDirtySet::fileChanged(const QString& localFile)
+{
+    KDevelop::IndexedString file(localFile);
+    //directories, build output and files hidden by the project filters,
+    //new files are queued by rowsInserted() once they are in the project
+    if (!m_scanned.contains(file) && m_project->filesForPath(file).isEmpty()) return;
+    queueRecheck(m_project->path().relativePath(KDevelop::Path(localFile)));
+}
+
+void UploadDirtySet::rowsInserted(const QModelIndex& parent, int first, int last)
+{
+    KDevelop::ProjectModel* model = m_project->projectItem()->model();
+    QList<KDevelop::ProjectBaseItem*> items;
+    for (int row = first; row <= last; ++row) {
+        KDevelop::ProjectBaseItem* item = model->itemFromIndex(model->index(row, 0, parent));
+        if (item && item->project() == m_project) {
+            items << item;
+        }
+    }
+    //folders can come with their contents
+    while (!items.isEmpty()) {
+        KDevelop::ProjectBaseItem* item = items.takeLast();
+        if (item->file()) {
+            if (!m_unscanned.contains(item->indexedPath())) {
+                queueRecheck(m_project->path().relativePath(item->path()));
+            }
+        } else {
+            items += item->children();
+        }
+    }
+}
+
+void UploadDirtySet::entriesChanged(const QStringList& paths)
+{
+    if (m_checking) return;
+    Q_FOREACH (const QString& path, paths) {
+        queueRecheck(path);
+    }
+}
+
+void UploadDirtySet::queueRecheck(const QString& path)
+{
+    //results that are still on the way describe the file before this change
+    ++m_generations[path];
+    m_recheck.insert(path);
+    if (!m_recheckTimer->isActive()) {
+        m_recheckTimer->start();
+    }
+}
+
+void UploadDirtySet::recheck()
+{
+    QVector<ScanItem> items;
+    Q_FOREACH (const QString& path, m_recheck) {
+        KDevelop::IndexedString file(KDevelop::Path(m_project->path(), path).pathOrUrl());
+        items << scanItem(file, path);
+        if (items.count() == scanBatchSize) {
+            m_workers.start(new ScanTask(items, this));
+            items.clear();
+        }
+    }
+    m_recheck.clear();
+    if (!items.isEmpty()) {
+        m_workers.start(new ScanTask(items, this));
+    }
+}
+
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
@@ -0,0 +1,225 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+
+#ifndef UPLOADDIRTYSET_H
+#define UPLOADDIRTYSET_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+
+#include <kconfiggroup.h>
+
+#include <serialization/indexedstring.h>
+
+#include "uploadfingerprint.h"
+
+class QModelIndex;
+class QTimer;
+namespace KDevelop {
+    class IProject;
+}
+class UploadStateStore;
+
+/**
+ * The files of a project that are modified for an upload-profile.
+ *
+ * Filled by one scan of all project files when it is created. The files are
+ * stat'ed and hashed in parallel on a pool of worker threads, the results come
+ * back to the GUI thread in batches and are announced with changed(), so a view
+ * can show them while the scan goes on. After that it is kept up to date
+ * incrementally: files that change on disk, files added to the project and
+ * files whose upload state changes are checked again, nothing else is stat'ed.
+ * Reading if a file is modified is a set lookup. A file without a result yet
+ * counts as modified until it is checked.
+ *
+ * Paths are relative to the project directory, like in UploadStateStore.
+ */
+class UploadDirtySet : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Returns the dirty set for an upload-profile, creates it and starts the scan on first use.
+     * The set is a child of the project and deleted with it.
+     */
+    static UploadDirtySet* forProfile(KDevelop::IProject* project, const KConfigGroup& profile);
+
+    /**
+     * Deletes the dirty set of a removed upload-profile
+     * @param profileGroup name of the profile's config group, eg. "Profile1"
+     */
+    static void discard(KDevelop::IProject* project, const QString& profileGroup);
+
+    ~UploadDirtySet() override;
+
+    /**
+     * Returns true when the initial scan is done
+     */
+    bool isReady() const {
+        return m_unscanned.isEmpty();
+    }
+
+    /**
+     * Returns true if there is a result for a file of the project
+     */
+    bool isScanned(const KDevelop::IndexedString& file) const {
+        return m_scanned.contains(file);
+    }
+
+    /**
+     * Returns true if the initial scan didn't get the result for a file of the project yet
+     */
+    bool isScanning(const KDevelop::IndexedString& file) const {
+        return m_unscanned.contains(file);
+    }
+
+    /**
+     * Returns true if a scanned file is modified, false for files without a result
+     */
+    bool contains(const QString& path) const {
+        return m_dirty.contains(path);
+    }
+
+    /**
+     * Returns true if a file changed since it was uploaded, or was never uploaded.
+     * A file without a result yet counts as modified and is queued for a check,
+     * nothing is stat'ed or hashed on the calling thread.
+     */
+    bool isModified(const QString& path, const QString& localFile);
+
+    /**
+     * Returns true if a modified file is somewhere below a directory, without looking at the files.
+     * @param directory path relative to the project directory, empty for the project itself
+     */
+    bool containsBelow(const QString& directory) const {
+        return m_dirtyDirectories.contains(directory);
+    }
+
+    /**
+     * Returns the modified files, complete once isReady()
+     */
+    QSet<QString> paths() const {
+        return m_dirty;
+    }
+
+    /**
+     * A file to check, with its upload state looked up on the GUI thread
+     */
+    struct ScanItem {
+        uint file; ///< index of the IndexedString of the local file
+        QString path;
+        QString localFile;
+        UploadFingerprint recorded;
+        QDateTime uploadTime;
+        uint generation; ///< of the path when it was queued
+    };
+
+    /**
+     * Outcome of the check of a file
+     */
+    struct ScanResult {
+        uint file;
+        QString path;
+        bool modified;
+        UploadFingerprint touched; ///< new stat of a file that was only touched, or the hash it lacked
+        uint generation;
+    };
+
+    /**
+     * Called by the workers with the results of a batch
+     */
+    void addResults(const QVector<ScanResult>& results);
+
+Q_SIGNALS:
+    /**
+     * Emitted for a batch of files that were scanned or changed their modified state
+     */
+    void changed(const QList<KDevelop::IndexedString>& files);
+
+    /**
+     * Emitted when the initial scan is done
+     */
+    void ready();
+
+private Q_SLOTS:
+    /**
+     * Looks up the upload state of the next files of the initial scan and hands them to the workers
+     */
+    void scanBatch();
+
+    /**
+     * Takes the results the workers finished so far
+     */
+    void applyResults();
+
+    /**
+     * Queues a file that changed on disk to be checked again
+     */
+    void fileChanged(const QString& localFile);
+
+    /**
+     * Queues the files of items added to the project model to be checked
+     */
+    void rowsInserted(const QModelIndex& parent, int first, int last);
+
+    /**
+     * Queues files whose upload state changed to be checked again
+     */
+    void entriesChanged(const QStringList& paths);
+
+    /**
+     * Hands the queued files to the workers
+     */
+    void recheck();
+
+private:
+    UploadDirtySet(KDevelop::IProject* project, const KConfigGroup& profile, QObject* parent);
+
+    /**
+     * Looks up the upload state of a file, for a worker to check it
+     */
+    ScanItem scanItem(const KDevelop::IndexedString& file, const QString& path);
+
+    /**
+     * Adds a file to or removes it from the set and updates the counters of its directories
+     * @return true if the set changed
+     */
+    bool setModified(const QString& path, bool modified);
+
+    /**
+     * Queues a file to be checked, results of checks queued before are dropped
+     */
+    void queueRecheck(const QString& path);
+
+    KDevelop::IProject* m_project;
+    UploadStateStore* m_stateStore;
+    QSet<QString> m_dirty; ///< modified files
+    QHash<QString, int> m_dirtyDirectories; ///< number of modified files below each directory that has some
+    QList<KDevelop::IndexedString> m_scanQueue; ///< files the initial scan didn't hand to the workers yet
+    QSet<KDevelop::IndexedString> m_unscanned; ///< files the initial scan has no result for yet
+    QSet<KDevelop::IndexedString> m_scanned; ///< files with a result, unknown files count as modified
+    QSet<QString> m_recheck; ///< files to check again
+    QHash<QString, uint> m_generations; ///< bumped when a file changes or is queued, older results are stale
+    QTimer* m_recheckTimer;
+    bool m_checking; ///< if the state store is changed by our own results
+
+    QThreadPool m_workers; ///< stat and hash the files, waited for when the set is deleted
+    QMutex m_resultsMutex;
+    QVector<ScanResult> m_results; ///< results of the workers not taken by applyResults yet
+};
+
+#endif
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
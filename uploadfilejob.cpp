@@ -0,0 +1,227 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+#include "uploadfilejob.h"
+
+#include <QBuffer>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardItemModel>
+
+#include <KLocalizedString>
+#include <kio/filecopyjob.h>
+#include <kio/job.h>
+#include <kio/storedtransferjob.h>
+#include <kio/transferjob.h>
+
+#include <interfaces/iproject.h>
+#include <util/path.h>
+
+#include "kdevuploaddebug.h"
+#include "uploadconnectionpool.h"
+#include "uploaddirtyset.h"
+#include "uploadfingerprint.h"
+#include "uploadjob.h"
+#include "uploadremotelisting.h"
+#include "uploadstatestore.h"
+
+UploadFileJob::UploadFileJob(KDevelop::IProject* project, const KConfigGroup& profile, const QUrl& url, QObject* parent)
+    : QObject(parent), m_project(project), m_profile(profile), m_url(url), m_stateStore(nullptr),
+      m_connectionPool(nullptr), m_outputModel(nullptr), m_createdParent(false), m_fromContents(false)
+{
+}
+
+UploadFileJob::~UploadFileJob()
+{
+}
+
+void UploadFileJob::setConnectionPool(UploadConnectionPool* pool)
+{
+    m_connectionPool = pool;
+}
+
+void UploadFileJob::setContents(const QByteArray& contents)
+{
+    m_contents = contents;
+    m_fromContents = true;
+}
+
+void UploadFileJob::setOutputModel(QStandardItemModel* model)
+{
+    m_outputModel = model;
+}
+
+void UploadFileJob::start()
+{
+    if (!m_profile.isValid()) {
+        appendLog(i18n("Cannot upload, no profile selected."));
+        deleteLater();
+        return;
+    }
+    m_started.start();
+    m_stateStore = UploadStateStore::forProfile(m_project, m_profile);
+
+    KDevelop::Path path(m_url);
+    KDevelop::Path localPath(m_profile.readEntry("localUrl", QUrl()).adjusted(QUrl::StripTrailingSlash).path());
+    if (localPath.path().isEmpty()) {
+        localPath = m_project->path();
+    }
+    m_relativeUrl = localPath.relativePath(path);
+    m_projectPath = m_project->path().relativePath(path);
+    m_dest = m_profile.readEntry("url", QUrl()).adjusted(QUrl::StripTrailingSlash);
+    m_dest.setPath(m_dest.path() + "/" + m_relativeUrl);
+
+    QString profileName = m_profile.readEntry("name", QString());
+    bool modified;
+    if (m_fromContents) {
+        UploadFingerprint recorded = m_stateStore->fingerprint(m_projectPath);
+        UploadFingerprint contents = UploadFingerprint::fromData(m_contents);
+        modified = !recorded.hasHash() || recorded.size() != contents.size() || recorded.hash() != contents.hash();
+    } else {
+        modified = UploadDirtySet::forProfile(m_project, m_profile)->isModified(m_projectPath, m_url.toLocalFile());
+    }
+    if (!modified) {
+        appendLog(i18n("File was not modified for %1: %2", profileName, m_relativeUrl));
+        deleteLater();
+        return;
+    }
+
+    appendLog(i18n("Uploading to %1: %2", profileName, m_relativeUrl));
+    startCopy();
+}
+
+void UploadFileJob::startCopy()
+{
+    KJob* job = nullptr;
+    if (m_fromContents) {
+        if (m_connectionPool) {
+            QBuffer* source = new QBuffer();
+            source->setData(m_contents);
+            source->open(QIODevice::ReadOnly);
+            job = m_connectionPool->put(source, m_dest);
+        } else {
+            job = KIO::storedPut(m_contents, m_dest, -1, KIO::Overwrite | KIO::HideProgressInfo);
+        }
+    } else {
+        //the editor contents above aren't the file on disk, they keep what the server sets
+        int permissions = -1;
+        QDateTime modified;
+        //the copy reads the file after this, a change from now on makes its fingerprint unknown
+        m_before = UploadFingerprint::fromFile(m_url.toLocalFile());
+        if (m_url.isLocalFile() && m_profile.readEntry("preserveAttributes", false)) {
+            QFileInfo info(m_url.toLocalFile());
+            permissions = UploadJob::localPermissions(info);
+            modified = info.lastModified();
+        }
+        if (m_connectionPool && m_url.isLocalFile()) {
+            QFile* source = new QFile(m_url.toLocalFile());
+            if (source->open(QIODevice::ReadOnly)) {
+                job = m_connectionPool->put(source, m_dest, permissions, modified);
+            } else {
+                delete source;
+            }
+        }
+        if (!job) {
+            KIO::FileCopyJob* copy = KIO::file_copy(m_url, m_dest, permissions, KIO::Overwrite | KIO::HideProgressInfo);
+            if (modified.isValid()) {
+                copy->setModificationTime(modified);
+            }
+            job = copy;
+        }
+    }
+    qCDebug(KDEVUPLOAD) << "quick upload" << m_url << m_dest;
+    connect(job, SIGNAL(result(KJob*)),
+            this, SLOT(copyResult(KJob*)));
+}
+
+void UploadFileJob::copyResult(KJob* job)
+{
+    if (job->error() && UploadJob::isMissingParentError(job->error()) && !m_createdParent) {
+        //create the missing directories and try once more
+        m_createdParent = true;
+        m_missingDirectories << UploadRemoteListing::parentUrl(m_dest);
+        startMkdir();
+        return;
+    }
+    if (job->error()) {
+        failed(job);
+        return;
+    }
+
+    m_stateStore->setUploaded(m_projectPath, QDateTime::currentDateTime());
+    UploadFingerprint fingerprint = m_fromContents ? UploadFingerprint::fromData(m_contents)
+                                    : UploadFingerprint::fromUploadedFile(m_url.toLocalFile(), m_before);
+    if (fingerprint.isValid()) {
+        m_stateStore->setFingerprint(m_projectPath, fingerprint);
+    }
+    m_stateStore->sync();
+
+    appendLog(i18n("Uploaded %1 in %2 ms", m_relativeUrl, m_started.elapsed()));
+    emit uploadFinished();
+    deleteLater();
+}
+
+void UploadFileJob::startMkdir()
+{
+    KIO::SimpleJob* job = KIO::mkdir(m_missingDirectories.last());
+    if (m_connectionPool) {
+        m_connectionPool->schedule(job);
+    }
+    connect(job, SIGNAL(result(KJob*)),
+            this, SLOT(mkdirResult(KJob*)));
+}
+
+void UploadFileJob::mkdirResult(KJob* job)
+{
+    QUrl directory = m_missingDirectories.last();
+    if (job->error() && job->error() != KIO::ERR_DIR_ALREADY_EXIST) {
+        QUrl parent = UploadRemoteListing::parentUrl(directory);
+        QUrl root = m_profile.readEntry("url", QUrl()).adjusted(QUrl::StripTrailingSlash);
+        if (UploadJob::isMissingParentError(job->error()) && (parent == root || root.isParentOf(parent))) {
+            //its parent is missing too, create that first
+            m_missingDirectories << parent;
+            startMkdir();
+            return;
+        }
+        failed(job);
+        return;
+    }
+    appendLog(i18n("Created missing directory: %1", directory.toDisplayString()));
+    m_missingDirectories.removeLast();
+    if (m_missingDirectories.isEmpty()) {
+        startCopy();
+    } else {
+        startMkdir();
+    }
+}
+
+void UploadFileJob::failed(KJob* job)
+{
+    QString readError = UploadConnectionPool::readError(job);
+    QStandardItem* item = appendLog(i18n("Upload error: %1", readError.isEmpty() ? job->errorString() : readError));
+    if (item) {
+        item->setForeground(Qt::red);
+    }
+    if (m_stateStore) {
+        m_stateStore->sync();
+    }
+    deleteLater();
+}
+
+QStandardItem* UploadFileJob::appendLog(const QString& message)
+{
+    if (m_outputModel) {
+        QStandardItem* item = new QStandardItem(message);
+        m_outputModel->appendRow(item);
+        return item;
+    } else {
+        return nullptr;
+    }
+}
+
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
@@ -0,0 +1,117 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+
+#ifndef UPLOADFILEJOB_H
+#define UPLOADFILEJOB_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QList>
+#include <QUrl>
+
+#include <kconfiggroup.h>
+
+#include "uploadfingerprint.h"
+
+class QStandardItemModel;
+class QStandardItem;
+class KJob;
+namespace KDevelop {
+    class IProject;
+}
+class UploadConnectionPool;
+class UploadStateStore;
+
+/**
+ * Uploads a single file of a project, used for Quick Upload of the current file.
+ *
+ * Unlike UploadJob it doesn't need an UploadProjectModel or a plan and shows
+ * no progress dialog: it checks the upload state of the file, starts one copy
+ * on the connection pool of the profile and logs the result to the output view.
+ */
+class UploadFileJob : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * @param profile config group of the upload-profile
+     * @param url local url of a file of the project
+     */
+    UploadFileJob(KDevelop::IProject* project, const KConfigGroup& profile, const QUrl& url, QObject* parent = nullptr);
+    ~UploadFileJob() override;
+
+    /**
+     * Sets the connected workers for the server of the profile, the copy runs on them
+     */
+    void setConnectionPool(UploadConnectionPool* pool);
+
+    /**
+     * Uploads contents instead of the file on disk, eg. the unsaved text of an editor.
+     * The fingerprint in the upload state is taken from contents too.
+     */
+    void setContents(const QByteArray& contents);
+
+    /**
+     * Sets the output model that should be used to output the log messages
+     */
+    void setOutputModel(QStandardItemModel* model);
+
+public Q_SLOTS:
+    /**
+     * Starts the upload, the job deletes itself when it is done
+     */
+    void start();
+
+Q_SIGNALS:
+    /**
+     * Signal is emitted when the upload successfully finished
+     */
+    void uploadFinished();
+
+private Q_SLOTS:
+    void copyResult(KJob* job);
+    void mkdirResult(KJob* job);
+
+private:
+    /**
+     * Starts the copy of the file to the destination
+     */
+    void startCopy();
+
+    /**
+     * Creates the topmost directory of m_missingDirectories
+     */
+    void startMkdir();
+
+    /**
+     * Logs the error of job and ends the upload
+     */
+    void failed(KJob* job);
+
+    QStandardItem* appendLog(const QString& message);
+
+    KDevelop::IProject* m_project;
+    KConfigGroup m_profile;
+    QUrl m_url; ///< local url of the file
+    QUrl m_dest; ///< destination url of the file
+    QString m_relativeUrl; ///< path relative to the local url of the profile, used for the log
+    QString m_projectPath; ///< path relative to the project, used for the upload state
+    UploadStateStore* m_stateStore;
+    UploadConnectionPool* m_connectionPool;
+    QStandardItemModel* m_outputModel;
+    QList<QUrl> m_missingDirectories; ///< destination directories to create before the copy is retried
+    bool m_createdParent; ///< if the parent directories were created after a failed copy
+    bool m_fromContents; ///< if m_contents is uploaded instead of the file
+    QByteArray m_contents;
+    UploadFingerprint m_before; ///< stat of the file when the copy started
+    QElapsedTimer m_started;
+};
+
+#endif
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
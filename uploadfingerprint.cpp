@@ -0,0 +1,179 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+#include "uploadfingerprint.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <QVector>
+#include <qplatformdefs.h>
+
+namespace {
+    const qint64 mapChunkSize = 64 * 1024 * 1024; ///< big files are mapped piece by piece
+
+    /**
+     * Fingerprints one file on a thread of the pool
+     */
+    class FingerprintTask : public QRunnable
+    {
+    public:
+        FingerprintTask(const QString& localFile, UploadFingerprint* result, QSemaphore* done,
+                        QAtomicInt* hashed, const QAtomicInt* canceled)
+            : m_localFile(localFile), m_result(result), m_done(done), m_hashed(hashed), m_canceled(canceled) {}
+
+        void run() override
+        {
+            if (!m_canceled || !m_canceled->load()) {
+                *m_result = UploadFingerprint::fromFile(m_localFile);
+                if (m_result->isValid()) {
+                    m_result->setHash(UploadFingerprint::hashFile(m_localFile));
+                }
+            }
+            if (m_hashed) {
+                m_hashed->ref();
+            }
+            m_done->release();
+        }
+
+    private:
+        QString m_localFile;
+        UploadFingerprint* m_result;
+        QSemaphore* m_done;
+        QAtomicInt* m_hashed;
+        const QAtomicInt* m_canceled;
+    };
+}
+
+UploadFingerprint::UploadFingerprint()
+    : m_size(-1), m_mtime(0), m_inode(0)
+{
+}
+
+UploadFingerprint::UploadFingerprint(qint64 size, qint64 modificationTime, quint64 inode, const QByteArray& hash)
+    : m_size(size), m_mtime(modificationTime), m_inode(inode), m_hash(hash)
+{
+}
+
+UploadFingerprint UploadFingerprint::fromFile(const QString& localFile)
+{
+    UploadFingerprint ret;
+    QT_STATBUF buf;
+    if (QT_STAT(QFile::encodeName(localFile).constData(), &buf) == 0) {
+        ret.m_size = buf.st_size;
+        ret.m_mtime = static_cast<qint64>(buf.st_mtime) * 1000;
+#ifdef Q_OS_LINUX
+        ret.m_mtime += buf.st_mtim.tv_nsec / 1000000;
+#endif
+        ret.m_inode = buf.st_ino;
+    }
+    return ret;
+}
+
+QList<UploadFingerprint> UploadFingerprint::fromFiles(const QStringList& localFiles, QAtomicInt* hashed,
+                                                     const QAtomicInt* canceled)
+{
+    QVector<UploadFingerprint> results(localFiles.count());
+    QSemaphore done;
+    for (int i = 0; i < localFiles.count(); ++i) {
+        QThreadPool::globalInstance()->start(new FingerprintTask(localFiles.at(i), &results[i], &done, hashed, canceled));
+    }
+    done.acquire(localFiles.count());
+    return results.toList();
+}
+
+UploadFingerprint UploadFingerprint::fromUploadedFile(const QString& localFile, const UploadFingerprint& before)
+{
+    if (!before.isValid()) return before;
+    UploadFingerprint now = fromFile(localFile);
+    if (now.sameStat(before)) {
+        QByteArray hash = hashFile(localFile);
+        //stat again, it may have been written while we read it
+        if (fromFile(localFile).sameStat(before)) {
+            now.setHash(hash);
+            return now;
+        }
+    }
+    //changed during the upload, we don't know which content was sent
+    UploadFingerprint ret = before;
+    ret.setHash(QByteArray());
+    return ret;
+}
+
+UploadFingerprint UploadFingerprint::fromString(const QString& string)
+{
+    UploadFingerprint ret;
+    QStringList fields = string.split(' ');
+    if (fields.count() == 4) {
+        ret.m_size = fields.at(0).toLongLong();
+        ret.m_mtime = fields.at(1).toLongLong();
+        ret.m_inode = fields.at(2).toULongLong();
+        ret.m_hash = QByteArray::fromHex(fields.at(3).toLatin1());
+    }
+    return ret;
+}
+
+QString UploadFingerprint::toString() const
+{
+    return QString("%1 %2 %3 %4").arg(m_size).arg(m_mtime).arg(m_inode)
+                                 .arg(QString::fromLatin1(m_hash.toHex()));
+}
+
+UploadFingerprint UploadFingerprint::fromData(const QByteArray& data)
+{
+    return UploadFingerprint(data.size(), 0, 0, QCryptographicHash::hash(data, QCryptographicHash::Md5));
+}
+
+QByteArray UploadFingerprint::hashFile(const QString& localFile)
+{
+    QFile file(localFile);
+    if (!file.open(QIODevice::ReadOnly)) return QByteArray();
+
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    qint64 size = file.size();
+    for (qint64 offset = 0; offset < size; offset += mapChunkSize) {
+        qint64 length = qMin(mapChunkSize, size - offset);
+        uchar* data = file.map(offset, length);
+        if (data) {
+            hash.addData(reinterpret_cast<const char*>(data), length);
+            file.unmap(data);
+        } else {
+            //not mappable (eg. a pipe or a special filesystem), read it instead
+            file.seek(offset);
+            hash.addData(file.read(length));
+        }
+    }
+    return hash.result();
+}
+
+bool UploadFingerprint::sameStat(const UploadFingerprint& other) const
+{
+    return m_size == other.m_size && m_mtime == other.m_mtime && m_inode == other.m_inode;
+}
+
+bool UploadFingerprint::isModified(const QString& localFile, UploadFingerprint* current) const
+{
+    UploadFingerprint now = fromFile(localFile);
+    bool modified;
+    if (!now.isValid()) {
+        //file is gone, nothing to upload
+        modified = false;
+    } else if (sameStat(now)) {
+        modified = false;
+    } else if (now.m_size != m_size || !hasHash()) {
+        modified = true;
+    } else {
+        now.m_hash = hashFile(localFile);
+        modified = now.m_hash != m_hash;
+    }
+    if (current) *current = now;
+    return modified;
+}
+
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
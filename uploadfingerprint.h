@@ -0,0 +1,120 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+
+#ifndef UPLOADFINGERPRINT_H
+#define UPLOADFINGERPRINT_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+/**
+ * What a file looked like when it was uploaded: size, modification time,
+ * inode and a hash of its content.
+ *
+ * The hash is only needed when the cheap fields differ, eg. after a touch or
+ * a git checkout that rewrote the file with the same content.
+ */
+class UploadFingerprint
+{
+public:
+    /**
+     * Creates an invalid fingerprint
+     */
+    UploadFingerprint();
+
+    UploadFingerprint(qint64 size, qint64 modificationTime, quint64 inode, const QByteArray& hash = QByteArray());
+
+    /**
+     * Stats a local file, the hash is left empty.
+     * @return an invalid fingerprint if the file does not exist
+     */
+    static UploadFingerprint fromFile(const QString& localFile);
+
+    /**
+     * Returns the fingerprint of content that doesn't come from a file, eg. an editor buffer.
+     * Only size and hash are set, so it never has the same stat as a file.
+     */
+    static UploadFingerprint fromData(const QByteArray& data);
+
+    /**
+     * Stats and hashes local files, the hashing is spread over the global thread pool.
+     * Blocks until all files are done, don't call it on the GUI thread for many files.
+     * @param hashed incremented for every file that is done, for progress
+     * @param canceled if set, the remaining files are left out and get an invalid fingerprint
+     * @return fingerprints in the same order as localFiles
+     */
+    static QList<UploadFingerprint> fromFiles(const QStringList& localFiles, QAtomicInt* hashed = nullptr,
+                                              const QAtomicInt* canceled = nullptr);
+
+    /**
+     * Stats and hashes a local file after it was uploaded.
+     * @param before stat of the file when the upload started
+     * @return the fingerprint with hash if the file didn't change since,
+     *         else before without hash, so the file counts as modified
+     */
+    static UploadFingerprint fromUploadedFile(const QString& localFile, const UploadFingerprint& before);
+
+    /**
+     * Parses a fingerprint written by toString()
+     */
+    static UploadFingerprint fromString(const QString& string);
+    QString toString() const;
+
+    /**
+     * Returns the hash of the content of a local file, read through a memory map.
+     * @return an empty QByteArray if the file can't be read
+     */
+    static QByteArray hashFile(const QString& localFile);
+
+    bool isValid() const {
+        return m_size >= 0;
+    }
+    bool hasHash() const {
+        return !m_hash.isEmpty();
+    }
+
+    qint64 size() const {
+        return m_size;
+    }
+    qint64 modificationTime() const {
+        return m_mtime;
+    }
+    quint64 inode() const {
+        return m_inode;
+    }
+    QByteArray hash() const {
+        return m_hash;
+    }
+    void setHash(const QByteArray& hash) {
+        m_hash = hash;
+    }
+
+    /**
+     * Returns true if size, modification time and inode are equal
+     */
+    bool sameStat(const UploadFingerprint& other) const;
+
+    /**
+     * Checks if the content of a local file differs from this recorded fingerprint.
+     * The file is only hashed if the stat fields differ but the size is equal.
+     * @param current set to the fingerprint of the file, with hash if one was computed
+     */
+    bool isModified(const QString& localFile, UploadFingerprint* current = nullptr) const;
+
+private:
+    qint64 m_size; ///< -1 if invalid
+    qint64 m_mtime; ///< msecs since epoch
+    quint64 m_inode;
+    QByteArray m_hash;
+};
+
+#endif
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
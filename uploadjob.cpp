@@ -15,12 +15,21 @@
 #include <QtWidgets/QProgressDialog>
 #include <QUrl>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QTimer>
+#include <limits>
 #include "kdevuploaddebug.h"
 
 #include <kconfiggroup.h>
 #include <kmessagebox.h>
 #include <kio/job.h>
 #include <kio/copyjob.h>
+#include <kio/deletejob.h>
+#include <kio/filecopyjob.h>
+#include <kio/statjob.h>
 #include <kio/jobuidelegate.h>
 #include <KLocalizedString>
 #include <kjob.h>
@@ -32,48 +41,197 @@
 #include <util/path.h>
 
 #include "uploadprojectmodel.h"
+#include "uploadconcurrency.h"
+#include "uploadfingerprint.h"
+#include "uploadstatestore.h"
+#include "uploadremotelisting.h"
+#include "uploadconnectionpool.h"
+
+namespace {
+    const int maximumAttempts = 3; ///< how often an item is started before a transient error is fatal
+    const int sizeBatch = 256; ///< files sized per event loop iteration, so the transfers keep going
+    const int maximumSizeJobs = 4; ///< stat jobs for remote files running at the same time
+    const int deleteBatchSize = 64; ///< items deleted by one job
+    const int analysisProgressMsecs = 100; ///< how often the progress of hashing for the plan is shown
+
+    /**
+     * Fingerprints an uploaded file on a worker thread
+     */
+    class HashTask : public QRunnable
+    {
+    public:
+        HashTask(const QString& localFile, const QString& path, const UploadFingerprint& before, UploadJob* job)
+            : m_localFile(localFile), m_path(path), m_before(before), m_job(job) {}
+
+        void run() override
+        {
+            m_job->addFingerprint(m_path, UploadFingerprint::fromUploadedFile(m_localFile, m_before));
+        }
+
+    private:
+        QString m_localFile;
+        QString m_path;
+        UploadFingerprint m_before;
+        UploadJob* m_job; ///< waits for the workers before it is deleted
+    };
+
+    /**
+     * Finds the duplicates, moves and deletions of a plan on a worker thread
+     */
+    class AnalyzeTask : public QRunnable
+    {
+    public:
+        AnalyzeTask(UploadPlan* plan, UploadPlan::Progress* progress, UploadJob* job)
+            : m_plan(plan), m_progress(progress), m_job(job) {}
+
+        void run() override
+        {
+            m_plan->analyze(m_progress);
+            QMetaObject::invokeMethod(m_job, "planAnalyzed", Qt::QueuedConnection);
+        }
+
+    private:
+        UploadPlan* m_plan; ///< not touched by the job until planAnalyzed()
+        UploadPlan::Progress* m_progress;
+        UploadJob* m_job; ///< waits for the workers before it is deleted
+    };
+}
 
 UploadJob::UploadJob(KDevelop::IProject* project, UploadProjectModel* model, QWidget *parent)
-    : QObject(parent), m_project(project), m_uploadProjectModel(model),
-      m_onlyMarkUploaded(false), m_quickUpload(false), m_outputModel(nullptr)
+    : QObject(parent), m_planIndex(0), m_scanIndex(0), m_scanFinished(false), m_savedBytes(0), m_skeletonLevel(-1),
+      m_remoteListing(nullptr), m_connectionPool(nullptr), m_pendingFingerprints(0),
+      m_concurrency(nullptr), m_project(project), m_uploadProjectModel(model),
+      m_stateStore(nullptr), m_onlyMarkUploaded(false), m_dryRun(false), m_quickUpload(false), m_showProgress(true),
+      m_preserveAttributes(false), m_deleting(false), m_analyzing(false),
+      m_sourceDeletionsConfirmed(false), m_clockSkewMeasured(false), m_clockSkewReference(0), m_outputModel(nullptr)
 {
     m_progressDialog = new QProgressDialog();
     m_progressDialog->setWindowTitle(i18n("Uploading files"));
     m_progressDialog->setLabelText(i18n("Preparing..."));
     m_progressDialog->setModal(true);
+    //the maximum grows during the upload, reaching it doesn't mean the upload is done
+    m_progressDialog->setAutoReset(false);
+    m_progressDialog->setAutoClose(false);
+
+    connect(m_progressDialog, SIGNAL(canceled()),
+            this, SLOT(cancelClicked()));
 }
 
 UploadJob::~UploadJob()
 {
+    killRunningJobs();
+    //the workers call addFingerprint()
+    m_hashers.clear();
+    m_hashers.waitForDone();
     delete m_progressDialog;
+    delete m_concurrency;
 }
 
 void UploadJob::start()
 {
+    m_stateStore = m_uploadProjectModel->stateStore();
+    if (!m_stateStore) {
+        appendLog(i18n("Cannot upload, no profile selected."));
+        deleteLater();
+        return;
+    }
+    m_profileConfigGroup = m_uploadProjectModel->profileConfigGroup();
+    m_preserveAttributes = m_profileConfigGroup.readEntry("preserveAttributes", false);
+
     m_progressBytesDone = 0;
-    m_progressDialog->setLabelText(i18n("Calculating size..."));
     m_progressDialog->setValue(0);
-    m_progressDialog->show();
-
-    int sumSize = 0;
-    QModelIndex i;
-    while((i = m_uploadProjectModel->nextRecursionIndex(i)).isValid()) {
-        KDevelop::ProjectBaseItem* item = m_uploadProjectModel->item(i);
-        Qt::CheckState checked = static_cast<Qt::CheckState>(m_uploadProjectModel
-                                ->data(i, Qt::CheckStateRole).toInt());
-        if (item->file() && checked != Qt::Unchecked) {
-            KIO::UDSEntry entry;
-            KIO::StatJob *statjob = KIO::stat(item->path().toUrl());
-            KJobWidgets::setWindow(statjob, m_progressDialog);
-            if (statjob->exec()) {
-                entry = statjob->statResult();
-                sumSize += entry.numberValue(KIO::UDSEntry::UDS_SIZE);
-            }
+    if (m_showProgress) {
+        m_progressDialog->show();
+    } else {
+        //QProgressDialog shows itself when the upload takes a while
+        m_progressDialog->setMinimumDuration(std::numeric_limits<int>::max());
+    }
+
+    if (m_files.isEmpty()) {
+        m_plan = UploadPlan::create(m_project, m_uploadProjectModel);
+    } else {
+        m_plan = UploadPlan::create(m_project, m_uploadProjectModel, m_files);
+    }
+    if (m_plan.needsAnalysis()) {
+        //hashing can take a while, the dialog stays responsive and shows how far it got
+        m_progressDialog->setLabelText(i18n("Comparing file contents..."));
+        m_analyzing = true;
+        m_hashers.start(new AnalyzeTask(&m_plan, &m_analysisProgress, this));
+        analysisProgress();
+        return;
+    }
+    startPlan();
+}
+
+void UploadJob::analysisProgress()
+{
+    if (!m_analyzing) return;
+    int toHash = m_analysisProgress.toHash.load();
+    if (toHash) {
+        m_progressDialog->setLabelText(i18n("Comparing file contents (%1 of %2)...",
+                                            m_analysisProgress.hashed.load(), toHash));
+        m_progressDialog->setMaximum(toHash);
+        m_progressDialog->setValue(m_analysisProgress.hashed.load());
+    }
+    QTimer::singleShot(analysisProgressMsecs, this, SLOT(analysisProgress()));
+}
+
+void UploadJob::planAnalyzed()
+{
+    m_analyzing = false;
+    //canceled while the worker finished
+    if (m_progressDialog->wasCanceled()) return;
+    m_progressDialog->setValue(0);
+    startPlan();
+}
+
+void UploadJob::startPlan()
+{
+    m_planIndex = 0;
+    m_scanIndex = 0;
+    m_scanFinished = false;
+    m_deleting = false;
+
+    if (!m_dryRun && !m_onlyMarkUploaded && !confirmDeletions()) {
+        appendLog(i18n("Upload canceled"));
+        deleteLater();
+        return;
+    }
+
+    if (m_dryRun) {
+        //the report needs all sizes
+        m_progressDialog->setLabelText(i18n("Calculating size..."));
+        scanSizes();
+        return;
+    }
+
+    //start with what the last upload to this profile settled on
+    delete m_concurrency;
+    m_concurrency = new UploadConcurrency(
+        m_profileConfigGroup.readEntry("concurrencyLimit", m_uploadProjectModel->currentProfileConcurrency()),
+        m_profileConfigGroup.readEntry("concurrencyCeiling", static_cast<int>(UploadConcurrency::MaximumLimit)));
+    if (m_connectionPool) {
+        //the workers run their jobs one after the other, more jobs would only queue
+        m_concurrency->setMaximum(m_connectionPool->size());
+    }
+
+    delete m_remoteListing;
+    m_remoteListing = new UploadRemoteListing(this);
+    m_remoteListing->setConnectionPool(m_connectionPool);
+    if (m_connectionPool) {
+        if (m_connectionPool->isWarm()) {
+            appendLog(i18n("Using open connection to %1", m_connectionPool->url().toDisplayString()));
+        } else {
+            appendLog(i18n("Connecting to %1", m_connectionPool->url().toDisplayString()));
         }
     }
-    m_progressDialog->setMaximum(sumSize);
+    connect(m_remoteListing, SIGNAL(listed(QUrl)),
+            this, SLOT(directoryListed()));
 
-    m_uploadIndex = QModelIndex();
+    if (!m_onlyMarkUploaded) {
+        createSkeleton();
+    }
+    scanSizes();
     uploadNext();
 }
 
@@ -81,98 +239,392 @@ void UploadJob::uploadNext()
 {
     if (m_progressDialog->wasCanceled()) return;
 
-    m_uploadIndex = m_uploadProjectModel->nextRecursionIndex(m_uploadIndex);
+    while (!m_readyQueue.isEmpty() && m_runningJobs.count() < m_concurrency->limit()) {
+        startJob(m_readyQueue.takeFirst());
+    }
 
-    if (!m_uploadIndex.isValid()) {
-        //last index reached - completed
+    const QVector<UploadPlan::Operation>& operations = m_plan.operations();
+    while (m_planIndex < operations.count() && m_runningJobs.count() < m_concurrency->limit()) {
+        int index = m_planIndex++;
+        const UploadPlan::Operation& operation = operations.at(index);
+
+        if (operation.action == UploadPlan::Skip) {
+            if (isQuickUpload()) {
+                appendLog(i18n("File was not modified for %1: %2",
+                                    m_plan.profileName(),
+                                    operation.relativeUrl));
+            }
+            continue;
+        }
+        if (operation.action == UploadPlan::MakeDirectory && !m_onlyMarkUploaded) {
+            //created by createSkeleton()
+            continue;
+        }
+        if (operation.action == UploadPlan::DeleteFile) {
+            if (m_onlyMarkUploaded) continue;
+            if (!m_deleting && !uploadsDone()) {
+                //the deletions come last in the plan, they wait until every upload succeeded
+                --m_planIndex;
+                break;
+            }
+            m_deleting = true;
+            RunningUpload batch = runningUpload(operation, index);
+            batch.batch << index;
+            while (batch.batch.count() < deleteBatchSize && m_planIndex < operations.count()
+                   && operations.at(m_planIndex).action == UploadPlan::DeleteFile) {
+                batch.batch << m_planIndex++;
+            }
+            Q_FOREACH (int i, batch.batch) {
+                appendLog(i18n("Deleting from %1: %2", m_plan.profileName(), operations.at(i).relativeUrl));
+            }
+            startJob(batch);
+            m_progressDialog->setLabelText(i18np("Deleting 1 item...", "Deleting %1 items...", batch.batch.count()));
+            continue;
+        }
+
+        RunningUpload upload = runningUpload(operation, index);
+
+        if (m_onlyMarkUploaded) {
+            appendLog(i18n("Marked as uploaded for %1: %2",
+                                m_plan.profileName(),
+                                operation.relativeUrl));
+            m_markedUploaded << operation.projectPath;
+            if (operation.action != UploadPlan::MakeDirectory) {
+                //only the stat, the dirty set hashes the file later on a worker
+                UploadFingerprint fingerprint = UploadFingerprint::fromFile(operation.url.toLocalFile());
+                if (fingerprint.isValid()) {
+                    m_markedFiles << operation.projectPath;
+                    m_markedFingerprints << fingerprint;
+                }
+            }
+            continue;
+        }
+
+        if (operation.action == UploadPlan::MoveFile) {
+            appendLog(i18n("Moving in %1: %2 to %3", m_plan.profileName(),
+                           operation.sourceRelativeUrl, operation.relativeUrl));
+        } else if (operation.action == UploadPlan::DuplicateFile) {
+            appendLog(i18n("Copying in %1: %2 to %3", m_plan.profileName(),
+                           operation.sourceRelativeUrl, operation.relativeUrl));
+            if (operation.sourceIndex != -1 && !m_finishedOperations.contains(operation.sourceIndex)) {
+                //the file it is copied from isn't uploaded yet
+                m_waitingForSource[operation.sourceIndex] << upload;
+                continue;
+            }
+        } else {
+            appendLog(i18n("Uploading to %1: %2",
+                                m_plan.profileName(),
+                                operation.relativeUrl));
+        }
+        QString parent = parentRelativeUrl(operation.relativeUrl);
+        if (m_pendingDirectories.contains(parent)) {
+            //the directory this file goes into isn't created yet, start it when it is
+            m_waitingForDirectory[parent] << upload;
+            continue;
+        }
+        qCDebug(KDEVUPLOAD) << "file_copy" << operation.url << operation.dest;
+        startJob(upload);
+        m_progressDialog->setLabelText(i18n("Uploading %1...", operation.relativeUrl));
+    }
+
+    if (m_planIndex >= operations.count() && uploadsDone() && !m_pendingFingerprints) {
+        //last operation done - completed
+        saveConcurrency();
+        if (m_savedBytes > 0) {
+            appendLog(i18n("Copied duplicates in %1 instead of uploading them, saved %2",
+                           m_plan.profileName(), KIO::convertSize(m_savedBytes)));
+        }
+        if (!m_markedUploaded.isEmpty()) {
+            m_stateStore->setUploaded(m_markedUploaded, QDateTime::currentDateTime());
+        }
+        if (!m_markedFiles.isEmpty()) {
+            m_stateStore->setFingerprints(m_markedFiles, m_markedFingerprints);
+        }
+        if (!isQuickUpload()) {
+            //forget files that were deleted since they were uploaded
+            m_stateStore->collectGarbage(m_project->path());
+        }
+        m_stateStore->sync();
         appendLog(i18n("Upload completed"));
         emit uploadFinished();
         delete this;
-        return;
     }
+}
 
-    if (!m_uploadIndex.parent().isValid()) {
-        //don't upload project root
-        uploadNext();
-        return;
+bool UploadJob::uploadsDone() const
+{
+    return m_runningJobs.isEmpty() && m_readyQueue.isEmpty() && m_listingDirectories.isEmpty()
+        && m_waitingForDirectory.isEmpty() && m_waitingForSource.isEmpty();
+}
+
+void UploadJob::sourceDone(int planIndex)
+{
+    m_finishedOperations.insert(planIndex);
+    Q_FOREACH (const RunningUpload& upload, m_waitingForSource.take(planIndex)) {
+        QString parent = parentRelativeUrl(upload.relativeUrl);
+        if (m_pendingDirectories.contains(parent)) {
+            m_waitingForDirectory[parent] << upload;
+        } else {
+            m_readyQueue << upload;
+        }
     }
+}
 
-    KDevelop::ProjectBaseItem* item = m_uploadProjectModel->item(m_uploadIndex);
+bool UploadJob::confirmDeletions()
+{
+    if (!m_plan.deleteCount() && (!m_plan.moveCount() || !m_showProgress)) return true;
+    QStringList items;
+    Q_FOREACH (const UploadPlan::Operation& operation, m_plan.operations()) {
+        if (operation.action == UploadPlan::DeleteFile) {
+            items << operation.relativeUrl;
+        } else if (operation.action == UploadPlan::MoveFile) {
+            //a move that fails is uploaded instead, the old path is deleted then
+            items << i18n("%1 (only if moving it to %2 fails)", operation.sourceRelativeUrl, operation.relativeUrl);
+        }
+    }
+    QString text;
+    if (m_plan.deleteCount()) {
+        text = i18np("This item was deleted locally and will be deleted from %2 after the upload:",
+                     "These %1 items were deleted locally and will be deleted from %2 after the upload:",
+                     m_plan.deleteCount(), m_plan.profileName());
+    } else {
+        text = i18np("This item is moved in %2, its old path will be deleted if the move fails:",
+                     "These %1 items are moved in %2, their old paths will be deleted if the move fails:",
+                     m_plan.moveCount(), m_plan.profileName());
+    }
+    if (KMessageBox::warningContinueCancelList(m_progressDialog, text, items, i18n("Mirror Deletions"),
+                                               KStandardGuiItem::del()) != KMessageBox::Continue) {
+        return false;
+    }
+    m_sourceDeletionsConfirmed = true;
+    return true;
+}
 
-    Qt::CheckState checked = static_cast<Qt::CheckState>(m_uploadProjectModel
-                            ->data(m_uploadIndex, Qt::CheckStateRole).toInt());
+UploadJob::RunningUpload UploadJob::runningUpload(const UploadPlan::Operation& operation, int planIndex)
+{
+    RunningUpload upload;
+    switch (operation.action) {
+        case UploadPlan::MakeDirectory:
+            upload.operation = MakeDirectory;
+            break;
+        case UploadPlan::MoveFile:
+            upload.operation = MoveFile;
+            break;
+        case UploadPlan::DuplicateFile:
+            upload.operation = DuplicateFile;
+            break;
+        case UploadPlan::DeleteFile:
+            upload.operation = DeleteFiles;
+            break;
+        default:
+            upload.operation = CopyFile;
+            break;
+    }
+    upload.url = operation.url;
+    upload.dest = operation.dest;
+    upload.relativeUrl = operation.relativeUrl;
+    upload.projectPath = operation.projectPath;
+    upload.planIndex = planIndex;
+    upload.processedSize = 0;
+    upload.attempts = 0;
+    upload.createdParent = false;
+    upload.pickedUp = false;
+    return upload;
+}
 
-    KDevelop::Path url;
-    QUrl localUrl = m_uploadProjectModel->currentProfileLocalUrl().adjusted(QUrl::StripTrailingSlash);
+void UploadJob::createSkeleton()
+{
+    m_skeleton.clear();
+    const QVector<UploadPlan::Operation>& operations = m_plan.operations();
+    for (int i = 0; i < operations.count(); ++i) {
+        const UploadPlan::Operation& operation = operations.at(i);
+        if (operation.action != UploadPlan::MakeDirectory) continue;
 
-    KDevelop::Path localPath = KDevelop::Path(localUrl.path());
-    
-    if (item->folder()) {
-        url = item->folder()->path();
-    } else if (item->file()) {
-        url = item->file()->path();
+        int depth = operation.relativeUrl.count('/');
+        while (m_skeleton.count() <= depth) {
+            m_skeleton << QList<RunningUpload>();
+        }
+        m_skeleton[depth] << runningUpload(operation, i);
+        //files inside wait until we know the directory exists
+        m_pendingDirectories.insert(operation.relativeUrl);
     }
-    
-    if(localPath.path().isEmpty()) {
-        localPath = m_project->path();        
+    m_skeletonLevel = -1;
+    startSkeletonLevel();
+}
+
+void UploadJob::startSkeletonLevel()
+{
+    //skip empty levels, eg. when only files below a deep folder are uploaded
+    do {
+        ++m_skeletonLevel;
+    } while (m_skeletonLevel < m_skeleton.count() && m_skeleton.at(m_skeletonLevel).isEmpty());
+    if (m_skeletonLevel >= m_skeleton.count()) return;
+
+    QList<RunningUpload> level = m_skeleton.at(m_skeletonLevel);
+    Q_FOREACH (const RunningUpload& upload, level) {
+        m_skeletonPending.insert(upload.relativeUrl);
+    }
+    Q_FOREACH (const RunningUpload& upload, level) {
+        makeDirectory(upload);
     }
-    
-    QString relativeUrl(localPath.relativePath(url));
+}
 
-    if (isQuickUpload() && checked == Qt::Unchecked) {
-        appendLog(i18n("File was not modified for %1: %2",
-                            m_uploadProjectModel->currentProfileName(),
-                            relativeUrl));
+void UploadJob::makeDirectory(const RunningUpload& upload)
+{
+    switch (m_remoteListing->existence(upload.dest)) {
+        case UploadRemoteListing::Unknown:
+            m_listingDirectories << upload;
+            m_remoteListing->list(UploadRemoteListing::parentUrl(upload.dest));
+            break;
+        case UploadRemoteListing::Exists:
+            appendLog(i18n("Directory in %1 already exists: %2",
+                                m_plan.profileName(),
+                                upload.relativeUrl));
+            directoryDone(upload);
+            break;
+        case UploadRemoteListing::Missing:
+            appendLog(i18n("Creating directory in %1: %2",
+                                m_plan.profileName(),
+                                upload.relativeUrl));
+            qCDebug(KDEVUPLOAD) << "mkdir" << upload.dest;
+            m_readyQueue << upload;
+            break;
     }
+}
 
-    if (!(item->file() || item->folder()) || checked == Qt::Unchecked) {
-        uploadNext();
-        return;
+void UploadJob::createParent(RunningUpload upload)
+{
+    QString parent = parentRelativeUrl(upload.relativeUrl);
+    upload.createdParent = true;
+    m_waitingForDirectory[parent] << upload;
+    if (m_pendingDirectories.contains(parent)) return;
+
+    appendLog(i18n("Creating missing directory in %1: %2",
+                        m_plan.profileName(),
+                        parent));
+    RunningUpload directory;
+    directory.operation = MakeDirectory;
+    directory.url = UploadRemoteListing::parentUrl(upload.url);
+    directory.dest = UploadRemoteListing::parentUrl(upload.dest);
+    directory.relativeUrl = parent;
+    directory.planIndex = -1;
+    directory.processedSize = 0;
+    directory.attempts = 0;
+    directory.createdParent = false;
+    directory.pickedUp = false;
+    m_pendingDirectories.insert(parent);
+    m_readyQueue << directory;
+}
+
+void UploadJob::directoryListed()
+{
+    QList<RunningUpload> waiting = m_listingDirectories;
+    m_listingDirectories.clear();
+    Q_FOREACH (const RunningUpload& upload, waiting) {
+        makeDirectory(upload);
+    }
+    uploadNext();
+}
+
+void UploadJob::directoryDone(const RunningUpload& upload)
+{
+    m_remoteListing->addDirectory(upload.dest);
+    m_pendingDirectories.remove(upload.relativeUrl);
+    if (!upload.projectPath.isEmpty()) {
+        //not for directories that were created on demand
+        markUploaded(upload);
     }
+    m_readyQueue << m_waitingForDirectory.take(upload.relativeUrl);
 
-    QUrl dest = m_uploadProjectModel->currentProfileUrl().adjusted(QUrl::StripTrailingSlash);
-    dest.setPath(dest.path() + "/" + relativeUrl);
-    KIO::Job* job = nullptr;
+    if (m_skeletonPending.remove(upload.relativeUrl) && m_skeletonPending.isEmpty()) {
+        startSkeletonLevel();
+    }
+}
 
-    if (m_onlyMarkUploaded) {
-        appendLog(i18n("Marked as uploaded for %1: %2",
-                            m_uploadProjectModel->currentProfileName(),
-                            relativeUrl));
-        m_uploadProjectModel->profileConfigGroup()
-                .writeEntry(relativeUrl,
-                            QDateTime::currentDateTime());
-        uploadNext();
-        return;
-    } else if (item->file()) {
-        appendLog(i18n("Uploading to %1: %2",
-                            m_uploadProjectModel->currentProfileName(),
-                            relativeUrl));
-        qCDebug(KDEVUPLOAD) << "file_copy" << url.pathOrUrl() << dest;
-        job = KIO::file_copy(url.toUrl(), dest, -1, KIO::Overwrite | KIO::HideProgressInfo);
-        m_progressDialog->setLabelText(i18n("Uploading %1...", relativeUrl));
-    } else if (item->folder()) {
-        KIO::StatJob *statjob = KIO::stat(dest, KIO::StatJob::DestinationSide, 0);
-        KJobWidgets::setWindow(statjob, m_progressDialog);
-        if (statjob->exec()) {
-            appendLog(i18n("Directory in %1 already exists: %2",
-                                m_uploadProjectModel->currentProfileName(),
-                                relativeUrl));
-            m_uploadProjectModel->profileConfigGroup()
-                    .writeEntry(relativeUrl,
-                                QDateTime::currentDateTime());
-            uploadNext();
-            return;
-        } else {
-            appendLog(i18n("Creating directory in %1: %2",
-                                m_uploadProjectModel->currentProfileName(),
-                                relativeUrl));
-            qCDebug(KDEVUPLOAD) << "mkdir" << dest;
-            job = KIO::mkdir(dest);
+void UploadJob::startJob(RunningUpload upload)
+{
+    KIO::Job* job = nullptr;
+    switch (upload.operation) {
+        case MakeDirectory: {
+            KIO::SimpleJob* mkdir = KIO::mkdir(upload.dest);
+            if (m_connectionPool) {
+                m_connectionPool->schedule(mkdir);
+            }
+            job = mkdir;
+            break;
         }
-    } else {
-        uploadNext();
-        return;
+        case CopyFile: {
+            int permissions = -1;
+            QDateTime modified;
+            if (m_preserveAttributes && upload.url.isLocalFile()) {
+                //sent with the transfer, the worker sets them right after writing the file
+                QFileInfo info(upload.url.toLocalFile());
+                permissions = localPermissions(info);
+                modified = info.lastModified();
+            }
+            if (m_connectionPool && upload.url.isLocalFile() && !upload.dest.isLocalFile()) {
+                //file_copy can't run on a given worker, feed a put job instead
+                QFile* source = new QFile(upload.url.toLocalFile());
+                if (source->open(QIODevice::ReadOnly)) {
+                    job = m_connectionPool->put(source, upload.dest, permissions, modified);
+                    connect(job, SIGNAL(dataReq(KIO::Job*, QByteArray&)),
+                            this, SLOT(putPickedUp(KIO::Job*)));
+                    break;
+                }
+                delete source;
+            }
+            KIO::FileCopyJob* copy = KIO::file_copy(upload.url, upload.dest, permissions, KIO::Overwrite | KIO::HideProgressInfo);
+            if (modified.isValid()) {
+                copy->setModificationTime(modified);
+            }
+            job = copy;
+            break;
+        }
+        case MoveFile: {
+            const UploadPlan::Operation& operation = m_plan.operations().at(upload.planIndex);
+            KIO::SimpleJob* rename = KIO::rename(operation.source, upload.dest, KIO::Overwrite | KIO::HideProgressInfo);
+            if (m_connectionPool) {
+                m_connectionPool->schedule(rename);
+            }
+            job = rename;
+            break;
+        }
+        case DuplicateFile: {
+            //not on the pool, file_copy can't be bound to a worker
+            const UploadPlan::Operation& operation = m_plan.operations().at(upload.planIndex);
+            int permissions = -1;
+            QDateTime modified;
+            if (m_preserveAttributes && upload.url.isLocalFile()) {
+                //the attributes of the local file, not of the remote one it is copied from
+                QFileInfo info(upload.url.toLocalFile());
+                permissions = localPermissions(info);
+                modified = info.lastModified();
+            }
+            KIO::FileCopyJob* copy = KIO::file_copy(operation.source, upload.dest, permissions, KIO::Overwrite | KIO::HideProgressInfo);
+            if (modified.isValid()) {
+                copy->setModificationTime(modified);
+            }
+            job = copy;
+            break;
+        }
+        case DeleteFiles: {
+            QList<QUrl> urls;
+            Q_FOREACH (int index, upload.batch) {
+                urls << m_plan.operations().at(index).dest;
+            }
+            job = KIO::del(urls, KIO::HideProgressInfo);
+            break;
+        }
+    }
+    if ((upload.operation == CopyFile || upload.operation == DuplicateFile) && upload.url.isLocalFile()) {
+        //the job reads the file after this, a change from now on makes its fingerprint unknown
+        upload.before = UploadFingerprint::fromFile(upload.url.toLocalFile());
     }
+    upload.processedSize = 0;
+    upload.started.start();
+    upload.pickedUp = false;
+    ++upload.attempts;
+    m_runningJobs.insert(job, upload);
 
     KJobWidgets::setWindow(job, m_progressDialog);
     connect(job, SIGNAL(result(KJob*)),
@@ -181,16 +633,210 @@ void UploadJob::uploadNext()
             this, SLOT(processedSize(KJob*, qulonglong)));
     connect(job, SIGNAL(infoMessage(KJob*, QString)),
             this, SLOT(uploadInfoMessage(KJob*, QString)));
-
-    connect(m_progressDialog, SIGNAL(canceled()),
-            this, SLOT(cancelClicked()));
-    connect(m_progressDialog, SIGNAL(rejected()),
-            job, SLOT(kill()));
     job->start();
 }
 
+void UploadJob::scanSizes()
+{
+    if (m_scanFinished) return;
+
+    const QVector<UploadPlan::Operation>& operations = m_plan.operations();
+    int scanned = 0;
+    while (m_scanIndex < operations.count() && scanned < sizeBatch && m_sizeJobs.count() < maximumSizeJobs) {
+        int index = m_scanIndex++;
+        const UploadPlan::Operation& operation = operations.at(index);
+        if (operation.action != UploadPlan::CopyFile || operation.size >= 0) continue;
+        ++scanned;
+        if (operation.url.isLocalFile()) {
+            QFileInfo info(operation.url.toLocalFile());
+            if (info.exists()) {
+                m_plan.setSize(index, info.size());
+            }
+        } else {
+            KIO::StatJob* job = KIO::stat(operation.url, KIO::StatJob::SourceSide, 0, KIO::HideProgressInfo);
+            KJobWidgets::setWindow(job, m_progressDialog);
+            m_sizeJobs.insert(job, index);
+            connect(job, SIGNAL(result(KJob*)),
+                    this, SLOT(sizeResult(KJob*)));
+        }
+    }
+
+    if (m_scanIndex < operations.count()) {
+        //stat jobs at the limit continue the scan from sizeResult
+        if (m_sizeJobs.count() < maximumSizeJobs) {
+            QTimer::singleShot(0, this, SLOT(scanSizes()));
+        }
+    } else if (m_sizeJobs.isEmpty()) {
+        m_scanFinished = true;
+    }
+
+    if (!m_dryRun) {
+        updateProgress();
+    } else if (m_scanFinished) {
+        Q_FOREACH (const QString& line, m_plan.report()) {
+            appendLog(line);
+        }
+        deleteLater();
+    }
+}
+
+void UploadJob::sizeResult(KJob* job)
+{
+    if (!m_sizeJobs.contains(job)) return;
+    int index = m_sizeJobs.take(job);
+    if (!job->error() && m_plan.operations().at(index).size < 0) {
+        KIO::StatJob* statJob = static_cast<KIO::StatJob*>(job);
+        m_plan.setSize(index, statJob->statResult().numberValue(KIO::UDSEntry::UDS_SIZE, -1));
+    }
+    scanSizes();
+}
+
+void UploadJob::killRunningJobs()
+{
+    if (m_remoteListing) {
+        m_remoteListing->abort();
+    }
+    m_listingDirectories.clear();
+    m_waitingForDirectory.clear();
+    m_waitingForSource.clear();
+
+    QHash<KJob*, int> sizeJobs = m_sizeJobs;
+    m_sizeJobs.clear();
+    Q_FOREACH (KJob* job, sizeJobs.keys()) {
+        job->disconnect(this);
+        job->kill(KJob::Quietly);
+    }
+
+    QHash<KJob*, RunningUpload> jobs = m_runningJobs;
+    m_runningJobs.clear();
+    QHashIterator<KJob*, RunningUpload> i(jobs);
+    while (i.hasNext()) {
+        i.next();
+        i.key()->disconnect(this);
+        i.key()->kill(KJob::Quietly);
+    }
+}
+
+bool UploadJob::isTransientError(int error)
+{
+    switch (error) {
+        case KIO::ERR_SERVER_TIMEOUT:
+        case KIO::ERR_CONNECTION_BROKEN:
+        case KIO::ERR_COULD_NOT_CONNECT:
+        case KIO::ERR_SLAVE_DIED:
+        case KIO::ERR_SERVICE_NOT_AVAILABLE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+int UploadJob::localPermissions(const QFileInfo& info)
+{
+    if (!info.exists()) return -1;
+    static const struct {
+        QFile::Permission permission;
+        int mode;
+    } modes[] = {
+        { QFile::ReadOwner, 0400 }, { QFile::WriteOwner, 0200 }, { QFile::ExeOwner, 0100 },
+        { QFile::ReadGroup, 040 }, { QFile::WriteGroup, 020 }, { QFile::ExeGroup, 010 },
+        { QFile::ReadOther, 04 }, { QFile::WriteOther, 02 }, { QFile::ExeOther, 01 }
+    };
+    QFile::Permissions permissions = info.permissions();
+    int mode = 0;
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+        if (permissions & modes[i].permission) {
+            mode |= modes[i].mode;
+        }
+    }
+    return mode;
+}
+
+bool UploadJob::isMissingParentError(int error)
+{
+    switch (error) {
+        case KIO::ERR_DOES_NOT_EXIST:
+        case KIO::ERR_CANNOT_OPEN_FOR_WRITING:
+        case KIO::ERR_COULD_NOT_MKDIR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void UploadJob::saveConcurrency()
+{
+    m_profileConfigGroup.writeEntry("concurrencyLimit", m_concurrency->limit());
+    m_profileConfigGroup.writeEntry("concurrencyCeiling", m_concurrency->ceiling());
+    m_profileConfigGroup.sync();
+}
+
+void UploadJob::fingerprintUploaded(const QString& localFile, const QString& path, const UploadFingerprint& before)
+{
+    if (!before.isValid()) return;
+    ++m_pendingFingerprints;
+    m_hashers.start(new HashTask(localFile, path, before, this));
+}
+
+void UploadJob::addFingerprint(const QString& path, const UploadFingerprint& fingerprint)
+{
+    QMutexLocker lock(&m_fingerprintsMutex);
+    bool first = m_fingerprintPaths.isEmpty();
+    m_fingerprintPaths << path;
+    m_fingerprints << fingerprint;
+    if (first) {
+        //later files are taken along, until applyFingerprints ran
+        QMetaObject::invokeMethod(this, "applyFingerprints", Qt::QueuedConnection);
+    }
+}
+
+void UploadJob::applyFingerprints()
+{
+    QStringList paths;
+    QList<UploadFingerprint> fingerprints;
+    {
+        QMutexLocker lock(&m_fingerprintsMutex);
+        paths.swap(m_fingerprintPaths);
+        fingerprints.swap(m_fingerprints);
+    }
+    if (paths.isEmpty()) return;
+
+    m_pendingFingerprints -= paths.count();
+    //committed to the journal together with the next ones
+    m_stateStore->setFingerprints(paths, fingerprints);
+    if (!m_pendingFingerprints && m_planIndex >= m_plan.operations().count()) {
+        //the upload waited for the last ones
+        uploadNext();
+    }
+}
+
+void UploadJob::finishFingerprints()
+{
+    m_hashers.clear();
+    m_hashers.waitForDone();
+    m_pendingFingerprints = 0;
+    QMutexLocker lock(&m_fingerprintsMutex);
+    if (!m_fingerprintPaths.isEmpty()) {
+        m_stateStore->setFingerprints(m_fingerprintPaths, m_fingerprints);
+        m_fingerprintPaths.clear();
+        m_fingerprints.clear();
+    }
+}
+
+QString UploadJob::parentRelativeUrl(const QString& relativeUrl)
+{
+    int slash = relativeUrl.lastIndexOf('/');
+    if (slash == -1) return QString();
+    return relativeUrl.left(slash);
+}
+
 void UploadJob::cancelClicked()
 {
+    //hashing for the plan stops at the next file
+    m_analysisProgress.canceled.store(1);
+    killRunningJobs();
+    finishFingerprints();
+    m_stateStore->sync();
     appendLog(i18n("Upload canceled"));
     deleteLater();
 }
@@ -198,43 +844,183 @@ void UploadJob::cancelClicked()
 
 void UploadJob::uploadResult(KJob* job)
 {
-    if (job->error()) {
-        if (job->error() == KIO::ERR_USER_CANCELED) {
+    if (!m_runningJobs.contains(job)) return;
+    RunningUpload upload = m_runningJobs.take(job);
+
+    if (upload.operation == MakeDirectory && job->error() == KIO::ERR_DIR_ALREADY_EXIST) {
+        //the listing of the parent was out of date
+        directoryDone(upload);
+        uploadNext();
+        return;
+    }
+
+    //deleting an item that is gone already is fine
+    bool alreadyDeleted = upload.operation == DeleteFiles && job->error() == KIO::ERR_DOES_NOT_EXIST;
+    if (alreadyDeleted && upload.batch.count() > 1) {
+        //one missing item fails the whole batch, delete them one by one
+        Q_FOREACH (int index, upload.batch) {
+            RunningUpload single = runningUpload(m_plan.operations().at(index), index);
+            single.batch << index;
+            m_readyQueue << single;
+        }
+        uploadNext();
+        return;
+    }
+
+    if (job->error() && !alreadyDeleted) {
+        //a put whose source couldn't be read was killed by the pool, not by the user
+        QString readError = UploadConnectionPool::readError(job);
+        if (job->error() == KIO::ERR_USER_CANCELED && readError.isEmpty()) {
             cancelClicked();
             return;
         }
+        if (upload.operation == MoveFile || upload.operation == DuplicateFile) {
+            //eg. the file it comes from was removed from the destination meanwhile
+            appendLog(i18n("Cannot create %1 in the destination, uploading it instead: %2",
+                           upload.relativeUrl, job->errorString()));
+            if (upload.operation == MoveFile && m_sourceDeletionsConfirmed) {
+                //the old path wasn't renamed away, it goes with the other deletions
+                m_plan.appendSourceDeletion(upload.planIndex);
+            } else if (upload.operation == MoveFile) {
+                appendLog(i18n("%1 is left in %2, its deletion was not confirmed",
+                               m_plan.operations().at(upload.planIndex).sourceRelativeUrl, m_plan.profileName()));
+            }
+            upload.operation = CopyFile;
+            upload.attempts = 0;
+            m_readyQueue << upload;
+            uploadNext();
+            return;
+        }
+        if (isMissingParentError(job->error()) && upload.operation != DeleteFiles
+            && !upload.createdParent && !upload.relativeUrl.isEmpty()) {
+            //the directory it goes into was removed or never existed, create it and try again
+            createParent(upload);
+            uploadNext();
+            return;
+        }
+        if (isTransientError(job->error()) && upload.attempts < maximumAttempts) {
+            //probably too many connections for this host, retry with less
+            m_concurrency->jobFailed();
+            appendLog(i18n("Retrying %1, using %2 parallel transfers: %3",
+                           upload.relativeUrl, m_concurrency->limit(), job->errorString()));
+            m_readyQueue << upload;
+            uploadNext();
+            return;
+        }
+        killRunningJobs();
+        saveConcurrency();
+        finishFingerprints();
+        m_stateStore->sync();
+        if (!readError.isEmpty()) {
+            appendLog(i18n("Upload error: %1", readError));
+            if (m_showProgress) {
+                KMessageBox::error(m_progressDialog, readError);
+            }
+            deleteLater();
+            return;
+        }
         appendLog(i18n("Upload error: %1", job->errorString()));
-        job->uiDelegate()->showErrorMessage();
+        if (m_showProgress) {
+            job->uiDelegate()->showErrorMessage();
+        }
         deleteLater();
         return;
     }
 
-    KDevelop::ProjectBaseItem* item = m_uploadProjectModel->item(m_uploadIndex);
-    QUrl url;
-    if (item->file()) {
-        url = item->file()->path().toUrl();
-    } else if (item->folder()) {
-        url = item->folder()->path().toUrl();
+    //only the transfers of file contents tell the concurrency how the server copes
+    if (upload.operation == MakeDirectory) {
+        directoryDone(upload);
+    } else if (upload.operation == MoveFile) {
+        //the recorded fingerprint is still right, it has the same content
+        m_stateStore->move(m_plan.operations().at(upload.planIndex).sourceProjectPath, upload.projectPath);
+        sourceDone(upload.planIndex);
+    } else if (upload.operation == DuplicateFile) {
+        m_savedBytes += m_plan.operations().at(upload.planIndex).size;
+        markUploaded(upload);
+        fingerprintUploaded(upload.url.toLocalFile(), upload.projectPath, upload.before);
+    } else if (upload.operation == DeleteFiles) {
+        Q_FOREACH (int index, upload.batch) {
+            m_stateStore->remove(m_plan.operations().at(index).projectPath);
+        }
+    } else {
+        qulonglong size = job->totalAmount(KJob::Bytes);
+        if (!size) size = upload.processedSize;
+        if (m_plan.operations().at(upload.planIndex).size < 0) {
+            //finished before the scan got to it
+            m_plan.setSize(upload.planIndex, size);
+        }
+        m_progressBytesDone += size;
+        m_concurrency->jobFinished(size, upload.started.elapsed());
+        if (!m_clockSkewMeasured && !m_preserveAttributes && !upload.dest.isLocalFile()) {
+            measureClockSkew(upload.dest);
+        }
+        markUploaded(upload);
+        fingerprintUploaded(upload.url.toLocalFile(), upload.projectPath, upload.before);
+        sourceDone(upload.planIndex);
+    }
+    updateProgress();
+
+    uploadNext();
+}
+
+void UploadJob::measureClockSkew(const QUrl& dest)
+{
+    m_clockSkewMeasured = true;
+    m_clockSkewReference = QDateTime::currentMSecsSinceEpoch() / 1000;
+    KIO::SimpleJob* job = KIO::stat(dest, KIO::StatJob::DestinationSide, 0, KIO::HideProgressInfo);
+    if (m_connectionPool) {
+        m_connectionPool->schedule(job);
     }
-    m_uploadProjectModel->profileConfigGroup()
-        .writeEntry(m_project->path().relativePath(KDevelop::Path(url)), QDateTime::currentDateTime());
-    m_uploadProjectModel->profileConfigGroup().sync();
+    connect(job, SIGNAL(result(KJob*)), this, SLOT(clockSkewResult(KJob*)));
+}
+
+void UploadJob::clockSkewResult(KJob* job)
+{
+    if (job->error()) return;
+    qint64 modified = static_cast<KIO::StatJob*>(job)->statResult().numberValue(KIO::UDSEntry::UDS_MODIFICATION_TIME, -1);
+    if (modified == -1) return;
+    //the server stamped the file when our upload ended, just before the reference
+    qint64 skew = modified - m_clockSkewReference;
+    qCDebug(KDEVUPLOAD) << "server clock skew" << skew << "secs" << m_plan.profileName();
+    m_profileConfigGroup.writeEntry("clockSkew", skew);
+    m_profileConfigGroup.sync();
+}
 
-    KIO::UDSEntry entry;
-    KIO::StatJob *statjob = KIO::stat(url, nullptr);
-    KJobWidgets::setWindow(statjob, m_progressDialog);
-    if (statjob->exec()) {
-        entry = statjob->statResult();
-        m_progressBytesDone += entry.numberValue(KIO::UDSEntry::UDS_SIZE);
+void UploadJob::updateProgress()
+{
+    qint64 done = m_progressBytesDone;
+    Q_FOREACH (const RunningUpload& u, m_runningJobs) {
+        done += u.processedSize;
     }
-    m_progressDialog->setValue(m_progressBytesDone);
+    qint64 total = qMax(m_plan.totalBytes(), done);
 
-    uploadNext();
+    //QProgressDialog only takes int, scale large uploads down
+    int shift = 0;
+    while ((total >> shift) > std::numeric_limits<int>::max()) ++shift;
+    m_progressDialog->setMaximum(static_cast<int>(total >> shift));
+    m_progressDialog->setValue(static_cast<int>(done >> shift));
+}
+
+void UploadJob::markUploaded(const RunningUpload& upload)
+{
+    //committed to the journal together with the next ones
+    m_stateStore->setUploaded(upload.projectPath, QDateTime::currentDateTime());
+}
+
+void UploadJob::processedSize(KJob* job, qulonglong size)
+{
+    if (!m_runningJobs.contains(job)) return;
+    m_runningJobs[job].processedSize = size;
+    updateProgress();
 }
 
-void UploadJob::processedSize(KJob*, qulonglong size)
+void UploadJob::putPickedUp(KIO::Job* job)
 {
-    m_progressDialog->setValue(m_progressBytesDone + size);
+    if (!m_runningJobs.contains(job)) return;
+    RunningUpload& upload = m_runningJobs[job];
+    if (upload.pickedUp) return;
+    upload.pickedUp = true;
+    upload.started.restart();
 }
 
 void UploadJob::uploadInfoMessage(KJob*, const QString& plain)
@@ -242,6 +1028,11 @@ void UploadJob::uploadInfoMessage(KJob*, const QString& plain)
     m_progressDialog->setLabelText(plain);
 }
 
+void UploadJob::setConnectionPool(UploadConnectionPool* pool)
+{
+    m_connectionPool = pool;
+}
+
 void UploadJob::setOutputModel(QStandardItemModel* model)
 {
     m_outputModel = model;
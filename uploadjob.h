@@ -13,8 +13,22 @@
 
 #include <QDialog>
 #include <QModelIndex>
+#include <QHash>
+#include <QSet>
+#include <QUrl>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+
+#include <kconfiggroup.h>
+
+#include "uploadfingerprint.h"
+#include "uploadplan.h"
 
 class QProgressDialog;
+class QFileInfo;
 class KJob;
 namespace KIO {
     class Job;
@@ -30,6 +44,10 @@ class QStandardItemModel;
 class QStandardItem;
 class UploadProjectModel;
 class UploadPlugin;
+class UploadConcurrency;
+class UploadStateStore;
+class UploadRemoteListing;
+class UploadConnectionPool;
 
 /**
  * Class that does the Uploading.
@@ -53,6 +71,32 @@ public:
         return m_onlyMarkUploaded;
     }
 
+    /**
+     * Sets if the upload should only log what it would do, with the number of files and bytes
+     */
+    void setDryRun(bool v) {
+        m_dryRun = v;
+    }
+    bool isDryRun() {
+        return m_dryRun;
+    }
+
+    /**
+     * Sets the files to upload, instead of the checked items of the model.
+     * Only the profile of the model is used then.
+     */
+    void setFiles(const QList<QUrl>& files) {
+        m_files = files;
+    }
+
+    /**
+     * Sets if the progress dialog is shown and errors are reported in a message box.
+     * Background uploads only log to the output view.
+     */
+    void setShowProgress(bool v) {
+        m_showProgress = v;
+    }
+
     /**
      * Sets if the upload is a quick upload.
      * If true, unmodified files will be logged too
@@ -61,12 +105,38 @@ public:
     bool isQuickUpload();
 
 
+    /**
+     * Sets the connected workers for the server of the profile, the jobs of the upload run on them
+     */
+    void setConnectionPool(UploadConnectionPool* pool);
+
     /**
      * Sets the output model that should be used to output the log messages
      */
     void setOutputModel(QStandardItemModel* model);
     QStandardItemModel* outputModel();
 
+    /**
+     * Returns true if the error is worth a retry with less parallel jobs,
+     * like a timeout or a refused connection
+     */
+    static bool isTransientError(int error);
+
+    /**
+     * Returns true if the error can mean that the destination directory doesn't exist
+     */
+    static bool isMissingParentError(int error);
+
+    /**
+     * Returns the permissions of a local file as the mode KIO takes, -1 if it can't be read
+     */
+    static int localPermissions(const QFileInfo& info);
+
+    /**
+     * Called by the workers with the fingerprint of an uploaded file
+     */
+    void addFingerprint(const QString& path, const UploadFingerprint& fingerprint);
+
 public Q_SLOTS:
     /**
      * Starts the upload
@@ -75,25 +145,69 @@ public Q_SLOTS:
 
 private Q_SLOTS:
     /**
-     * Upload the next (or first) item
+     * Starts jobs for the next items until all job slots are in use.
+     * Finishes the upload when all items are done.
      */
     void uploadNext();
 
     /**
-     * Called when current job is finished
+     * Called when one of the running jobs is finished
      */
     void uploadResult(KJob*);
 
+    /**
+     * Determines the sizes of the files in the plan a few at a time, while the upload is running.
+     * Local files are stat'ed directly, remote ones through KIO::stat jobs.
+     */
+    void scanSizes();
+
+    /**
+     * Called when the KIO::stat job for the size of a file is finished
+     */
+    void sizeResult(KJob*);
+
+    /**
+     * Called when the stat of the first uploaded file is finished, stores the clock skew of the server
+     */
+    void clockSkewResult(KJob* job);
+
+    /**
+     * Creates the directories that waited for the listing of their parent, or
+     * logs that they exist already
+     */
+    void directoryListed();
+
     /**
      * Updates the progress bar
      */
     void processedSize(KJob*, qulonglong);
 
+    /**
+     * Restarts the latency timer of a pooled put once its worker asks for the first data,
+     * the time it waited behind other jobs of the worker is not the latency of the transfer
+     */
+    void putPickedUp(KIO::Job* job);
+
     /**
      * Updates the progress text
      */
     void uploadInfoMessage(KJob*, const QString& plain);
 
+    /**
+     * Stores the fingerprints the workers finished so far
+     */
+    void applyFingerprints();
+
+    /**
+     * Shows how many files the analysis of the plan hashed, while it runs
+     */
+    void analysisProgress();
+
+    /**
+     * Called when the worker finished analyzing the plan, starts it
+     */
+    void planAnalyzed();
+
     /**
      * Cancel button in the ProgressDialog clicked
      */
@@ -106,22 +220,195 @@ Q_SIGNALS:
     void uploadFinished();
 
 private:
+    /**
+     * What a running job does for its item
+     */
+    enum Operation {
+        MakeDirectory,
+        CopyFile,
+        MoveFile, ///< the file is renamed in the destination, it was moved locally
+        DuplicateFile, ///< the file is copied from one with the same content in the destination
+        DeleteFiles ///< a batch of items is deleted from the destination
+    };
+
+    /**
+     * Item of the project that is transferred by a running job
+     */
+    struct RunningUpload {
+        Operation operation;
+        QUrl url; ///< local url of the item
+        QUrl dest; ///< destination url of the item
+        QString relativeUrl; ///< path relative to the local url of the profile, used for the log
+        QString projectPath; ///< path relative to the project, used for the upload state
+        int planIndex; ///< index of the operation in the plan
+        qulonglong processedSize; ///< bytes already transferred by the job
+        QElapsedTimer started; ///< time since the job was started, or a pooled put was picked up by its worker
+        bool pickedUp; ///< if a pooled put asked for its first data
+        int attempts; ///< how often the job was started, for retries after connection errors
+        bool createdParent; ///< if the parent directory was created on demand for it already
+        QVector<int> batch; ///< plan indexes of the items deleted by a DeleteFiles job
+        UploadFingerprint before; ///< stat of the local file when the job started
+    };
+
+    /**
+     * Runs the plan once it is created and analyzed, or logs it for a dry run
+     */
+    void startPlan();
+
+    /**
+     * Returns the item for an operation of the plan, ready to be started
+     */
+    static RunningUpload runningUpload(const UploadPlan::Operation& operation, int planIndex);
+
+    /**
+     * Creates the directories of the plan breadth-first, each level once the one above is done.
+     * The directories of a level are listed and created in parallel.
+     */
+    void createSkeleton();
+
+    /**
+     * Starts the next level of directories that is not empty
+     */
+    void startSkeletonLevel();
+
+    /**
+     * Creates a directory unless the listing of its parent shows it exists.
+     * If the parent is not listed yet the directory waits for the listing.
+     */
+    void makeDirectory(const RunningUpload& upload);
+
+    /**
+     * Creates the parent directory of an item whose job failed because it is missing
+     * and starts the item again once the directory exists.
+     */
+    void createParent(RunningUpload upload);
+
+    /**
+     * Records a directory that exists in the destination now, items inside may start
+     */
+    void directoryDone(const RunningUpload& upload);
+
+    /**
+     * Creates the job for the operation of an item, registers it as running and connects its signals
+     */
+    void startJob(RunningUpload upload);
+
+    /**
+     * Asks the user to confirm the deletions of the plan, showing the list of items.
+     * The old paths of moves are listed too, they are deleted if the move fails.
+     * @return false if the upload is canceled
+     */
+    bool confirmDeletions();
+
+    /**
+     * Records that the upload of a plan operation finished, the duplicates waiting for it may start
+     */
+    void sourceDone(int planIndex);
+
+    /**
+     * Returns true if the uploads of the plan are done and the deletions may start
+     */
+    bool uploadsDone() const;
+
+    /**
+     * Stores the concurrency limits the upload settled on in the profile
+     */
+    void saveConcurrency();
+
+    /**
+     * Stores the upload time of an item that finished
+     */
+    void markUploaded(const RunningUpload& upload);
+
+    /**
+     * Sets the progress to the finished bytes plus the bytes of the running jobs.
+     * The maximum grows while the sizes of the files are determined.
+     */
+    void updateProgress();
+
+    /**
+     * Hashes an uploaded file on a worker, its fingerprint is stored once that is done
+     * @param before stat of the file when its upload started
+     */
+    void fingerprintUploaded(const QString& localFile, const QString& path, const UploadFingerprint& before);
+
+    /**
+     * Stats a file that was just uploaded, the difference of its remote mtime to our clock
+     * lets UploadRemoteSnapshot compare remote times without preserved attributes
+     */
+    void measureClockSkew(const QUrl& dest);
+
+    /**
+     * Drops the files that are not hashed yet and stores the fingerprints of the others,
+     * when the upload ends early
+     */
+    void finishFingerprints();
+
+    /**
+     * Kills all jobs that are still running
+     */
+    void killRunningJobs();
+
+    /**
+     * Returns the relative path of the directory that contains relativeUrl
+     */
+    static QString parentRelativeUrl(const QString& relativeUrl);
+
     /**
      * Appends a message to the current outputModel.
      * @return the QStandardItem* to modify it further (to eg. change color)
      */
     QStandardItem* appendLog(const QString& message);
     
-    QModelIndex m_uploadIndex; ///< current index when the upload is running
+    UploadPlan m_plan; ///< what the upload does, created when it starts
+    UploadPlan::Progress m_analysisProgress; ///< of the worker analyzing m_plan
+    QList<QUrl> m_files; ///< files to upload, if the plan isn't taken from the model
+    int m_planIndex; ///< index of the next operation of m_plan to start
+    int m_scanIndex; ///< index of the next operation of m_plan to determine the size for
+    QHash<KJob*, int> m_sizeJobs; ///< running stat jobs for remote files, with their operation
+    bool m_scanFinished; ///< if the sizes of all files are determined
+
+    QHash<KJob*, RunningUpload> m_runningJobs; ///< jobs currently in flight
+    QList<RunningUpload> m_readyQueue; ///< retries and items whose directory exists now, started before the plan continues
+    QSet<QString> m_pendingDirectories; ///< relative urls of directories that are not yet created
+    QHash<QString, QList<RunningUpload> > m_waitingForDirectory; ///< items by the pending directory they go into
+    QHash<int, QList<RunningUpload> > m_waitingForSource; ///< duplicates by the plan index of the upload they copy
+    QSet<int> m_finishedOperations; ///< plan indexes of the uploads duplicates can be copied from
+    qint64 m_savedBytes; ///< bytes of the duplicates that were copied in the destination
+    QList<QList<RunningUpload> > m_skeleton; ///< directories of the plan by depth
+    int m_skeletonLevel; ///< depth of the directories that are created now
+    QSet<QString> m_skeletonPending; ///< directories of the current level that are not done
+    QList<RunningUpload> m_listingDirectories; ///< directories waiting for the listing of their parent
+    UploadRemoteListing* m_remoteListing; ///< which directories exist in the destination
+    UploadConnectionPool* m_connectionPool; ///< connected workers of the profile, may be nullptr
+    QThreadPool m_hashers; ///< hash the uploaded files, waited for when the upload ends
+    int m_pendingFingerprints; ///< files handed to m_hashers whose fingerprint is not stored yet
+    QMutex m_fingerprintsMutex;
+    QStringList m_fingerprintPaths; ///< paths of the fingerprints the workers finished, not stored yet
+    QList<UploadFingerprint> m_fingerprints;
+    QStringList m_markedUploaded; ///< paths marked as uploaded, stored at once when the walk is done
+    QStringList m_markedFiles; ///< files among them, with their stat in m_markedFingerprints
+    QList<UploadFingerprint> m_markedFingerprints; ///< stat without hash of the marked files
+    UploadConcurrency* m_concurrency; ///< decides how many jobs may run in parallel
 
     KDevelop::IProject* m_project; ///< the project of this job
-    UploadProjectModel* m_uploadProjectModel;
+    UploadProjectModel* m_uploadProjectModel; ///< only used to create the plan
+    UploadStateStore* m_stateStore; ///< upload state of the profile
+    KConfigGroup m_profileConfigGroup; ///< the profile the plan was created for
 
     QProgressDialog* m_progressDialog; ///< progress-dialog when the upload is running
-    int m_progressBytesDone; ///< uploaded bytes, incremented when a file is fully uploaded. used for progress.
+    qint64 m_progressBytesDone; ///< uploaded bytes, incremented when a file is fully uploaded. used for progress.
 
     bool m_onlyMarkUploaded; ///< if files should be only marked as uploaded
+    bool m_dryRun; ///< if the plan is only logged
     bool m_quickUpload; ///< if it is a quick upload
+    bool m_showProgress; ///< if the progress dialog and error messages are shown
+    bool m_preserveAttributes; ///< if uploaded files get the mtime and permissions of the local file
+    bool m_deleting; ///< if the deletions at the end of the plan started
+    bool m_analyzing; ///< if a worker analyzes m_plan, it isn't touched until it is done
+    bool m_sourceDeletionsConfirmed; ///< if the user agreed to delete the old paths of failed moves
+    bool m_clockSkewMeasured; ///< if the stat for the clock skew was started in this session
+    qint64 m_clockSkewReference; ///< our time in secs since the epoch when the measured upload ended
 
     QStandardItemModel* m_outputModel;
 };
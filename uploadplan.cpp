@@ -0,0 +1,447 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+#include "uploadplan.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QMultiHash>
+#include <QSet>
+
+#include <algorithm>
+
+#include <KLocalizedString>
+#include <kio/global.h>
+
+#include <interfaces/iproject.h>
+#include <serialization/indexedstring.h>
+#include <project/projectmodel.h>
+#include <util/path.h>
+
+#include "uploadprojectmodel.h"
+#include "uploaddirtyset.h"
+#include "uploadfingerprint.h"
+#include "uploadstatestore.h"
+
+UploadPlan::UploadPlan()
+    : m_fileCount(0), m_directoryCount(0), m_skippedCount(0), m_deleteCount(0), m_moveCount(0), m_duplicateCount(0),
+      m_savedBytes(0), m_totalBytes(0), m_deduplicate(false), m_mirrorDeletions(false)
+{
+}
+
+UploadPlan UploadPlan::create(KDevelop::IProject* project, UploadProjectModel* model)
+{
+    UploadPlan plan;
+    plan.m_profileName = model->currentProfileName();
+
+    KDevelop::Path localPath(model->currentProfileLocalUrl().adjusted(QUrl::StripTrailingSlash).path());
+    if (localPath.path().isEmpty()) {
+        localPath = project->path();
+    }
+    QUrl destBase = model->currentProfileUrl().adjusted(QUrl::StripTrailingSlash);
+    UploadDirtySet* dirtySet = UploadDirtySet::forProfile(project, model->profileConfigGroup());
+
+    QModelIndex i;
+    while ((i = model->nextRecursionIndex(i)).isValid()) {
+        if (!i.parent().isValid()) {
+            //don't upload project root
+            continue;
+        }
+        KDevelop::ProjectBaseItem* item = model->item(i);
+        if (!item->file() && !item->folder()) continue;
+
+        KDevelop::Path url = item->path();
+        Qt::CheckState checked = model->evaluatedCheckState(i);
+        if (model->isScanning(i)) {
+            //the upload doesn't wait for the scan, files without a result are uploaded
+            checked = dirtySet->isModified(project->path().relativePath(url), url.toLocalFile()) ? Qt::Checked : Qt::Unchecked;
+        }
+
+        Operation operation;
+        operation.reason = NoReason;
+        operation.url = url.toUrl();
+        operation.relativeUrl = localPath.relativePath(url);
+        operation.projectPath = project->path().relativePath(url);
+        operation.dest = destBase;
+        operation.dest.setPath(destBase.path() + "/" + operation.relativeUrl);
+        operation.size = -1;
+        operation.sourceIndex = -1;
+
+        if (checked == Qt::Unchecked) {
+            operation.action = Skip;
+            operation.reason = model->isCheckStateOverridden(i) ? NotSelected : NotModified;
+        } else if (item->folder()) {
+            operation.action = MakeDirectory;
+        } else {
+            operation.action = CopyFile;
+        }
+        plan.append(operation);
+    }
+
+    plan.m_deduplicate = supportsRemoteCopy(destBase);
+    plan.m_mirrorDeletions = model->profileConfigGroup().readEntry("mirrorDeletions", false);
+    if (plan.needsAnalysis()) {
+        //analyze() runs on a worker, it gets what it needs from the upload state now
+        plan.m_projectDirectory = project->path().path();
+        plan.m_localDirectory = localPath.path();
+        plan.m_destBase = destBase;
+        plan.m_remoteOnly = model->remoteOnly();
+        UploadStateStore* stateStore = model->stateStore();
+        Q_FOREACH (const QString& path, stateStore->paths()) {
+            KDevelop::Path url(project->path(), path);
+            if (!localPath.isParentOf(url)) continue;
+            UploadFingerprint fingerprint = stateStore->fingerprint(path);
+            plan.m_recorded.insert(path, fingerprint);
+            if (fingerprint.hasHash() && dirtySet->isScanned(KDevelop::IndexedString(url.pathOrUrl()))
+                && !dirtySet->contains(path)) {
+                plan.m_unmodified.insert(path);
+            }
+        }
+    }
+    return plan;
+}
+
+void UploadPlan::analyze(Progress* progress)
+{
+    KDevelop::Path projectPath(m_projectDirectory);
+    KDevelop::Path localPath(m_localDirectory);
+    if (m_deduplicate) {
+        deduplicate(projectPath, localPath, progress);
+    }
+    if (m_mirrorDeletions) {
+        //a rename removes the file at the old path, that's only done when deletions are mirrored
+        detectMoves(projectPath, localPath, progress);
+        //after all uploads, a failed upload stops the deletions
+        appendDeletions(projectPath, localPath);
+    }
+    m_deduplicate = false;
+    m_mirrorDeletions = false;
+    m_recorded.clear();
+    m_unmodified.clear();
+    m_remoteOnly.clear();
+}
+
+bool UploadPlan::supportsRemoteCopy(const QUrl& url)
+{
+    //KIO::file_copy within these sends one copy command, other workers download and upload again
+    static const char* const protocols[] = {
+        "file", "webdav", "webdavs"
+    };
+    for (size_t i = 0; i < sizeof(protocols) / sizeof(protocols[0]); ++i) {
+        if (url.scheme() == QLatin1String(protocols[i])) return true;
+    }
+    return false;
+}
+
+void UploadPlan::deduplicate(const KDevelop::Path& projectPath, const KDevelop::Path& localPath, Progress* progress)
+{
+    //files to upload by size
+    QMultiHash<qint64, int> bySize;
+    QSet<QString> uploaded;
+    for (int i = 0; i < m_operations.count(); ++i) {
+        const Operation& operation = m_operations.at(i);
+        if (operation.action != CopyFile) continue;
+        QFileInfo info(operation.url.toLocalFile());
+        if (info.size() > 0) {
+            bySize.insert(info.size(), i);
+        }
+        uploaded.insert(operation.projectPath);
+    }
+    if (bySize.isEmpty()) return;
+
+    //unmodified files that are in the destination already, by size and hash
+    QHash<QByteArray, QString> recorded;
+    QSet<qint64> recordedSizes;
+    Q_FOREACH (const QString& path, m_unmodified) {
+        if (uploaded.contains(path)) continue;
+        UploadFingerprint fingerprint = m_recorded.value(path);
+        if (!bySize.contains(fingerprint.size())) continue;
+        if (!QFile::exists(KDevelop::Path(projectPath, path).toLocalFile())) continue;
+        recorded.insert(QByteArray::number(fingerprint.size()) + ':' + fingerprint.hash(), path);
+        recordedSizes.insert(fingerprint.size());
+    }
+
+    //only files that can have a twin are hashed
+    QVector<int> candidates;
+    QStringList localFiles;
+    Q_FOREACH (qint64 size, bySize.uniqueKeys()) {
+        QList<int> operations = bySize.values(size);
+        if (operations.count() < 2 && !recordedSizes.contains(size)) continue;
+        Q_FOREACH (int i, operations) {
+            candidates << i;
+        }
+    }
+    if (candidates.isEmpty()) return;
+    std::sort(candidates.begin(), candidates.end());
+    Q_FOREACH (int i, candidates) {
+        localFiles << m_operations.at(i).url.toLocalFile();
+    }
+    progress->toHash.fetchAndAddRelaxed(localFiles.count());
+    QList<UploadFingerprint> fingerprints = UploadFingerprint::fromFiles(localFiles, &progress->hashed, &progress->canceled);
+
+    //in plan order, the first file of a group is uploaded
+    QHash<QByteArray, int> representatives;
+    for (int c = 0; c < candidates.count(); ++c) {
+        const UploadFingerprint& current = fingerprints.at(c);
+        if (!current.hasHash()) continue;
+        QByteArray key = QByteArray::number(current.size()) + ':' + current.hash();
+        Operation& operation = m_operations[candidates.at(c)];
+        if (recorded.contains(key)) {
+            operation.sourceProjectPath = recorded.value(key);
+            operation.sourceIndex = -1;
+        } else if (representatives.contains(key)) {
+            const Operation& representative = m_operations.at(representatives.value(key));
+            operation.sourceProjectPath = representative.projectPath;
+            operation.sourceIndex = representatives.value(key);
+        } else {
+            representatives.insert(key, candidates.at(c));
+            continue;
+        }
+        operation.action = DuplicateFile;
+        operation.sourceRelativeUrl = localPath.relativePath(KDevelop::Path(projectPath, operation.sourceProjectPath));
+        operation.source = m_destBase;
+        operation.source.setPath(m_destBase.path() + "/" + operation.sourceRelativeUrl);
+        if (operation.size > 0) m_totalBytes -= operation.size;
+        operation.size = current.size();
+        --m_fileCount;
+        ++m_duplicateCount;
+        m_savedBytes += current.size();
+    }
+}
+
+void UploadPlan::detectMoves(const KDevelop::Path& projectPath, const KDevelop::Path& localPath, Progress* progress)
+{
+    //uploaded files that are gone locally, by size
+    QMultiHash<qint64, QString> gone;
+    for (QHash<QString, UploadFingerprint>::const_iterator it = m_recorded.constBegin(); it != m_recorded.constEnd(); ++it) {
+        if (!it.value().isValid() || !it.value().hasHash()) continue;
+        if (!QFile::exists(KDevelop::Path(projectPath, it.key()).toLocalFile())) {
+            gone.insert(it.value().size(), it.key());
+        }
+    }
+    if (gone.isEmpty()) return;
+
+    //new files that may be one of them
+    QVector<int> candidates;
+    QStringList localFiles;
+    for (int i = 0; i < m_operations.count(); ++i) {
+        const Operation& operation = m_operations.at(i);
+        if (operation.action != CopyFile || m_recorded.contains(operation.projectPath)) continue;
+        if (gone.contains(QFileInfo(operation.url.toLocalFile()).size())) {
+            candidates << i;
+            localFiles << operation.url.toLocalFile();
+        }
+    }
+    if (candidates.isEmpty()) return;
+
+    progress->toHash.fetchAndAddRelaxed(localFiles.count());
+    QList<UploadFingerprint> fingerprints = UploadFingerprint::fromFiles(localFiles, &progress->hashed, &progress->canceled);
+    for (int c = 0; c < candidates.count(); ++c) {
+        const UploadFingerprint& current = fingerprints.at(c);
+        if (!current.hasHash()) continue;
+        QMultiHash<qint64, QString>::iterator it = gone.find(current.size());
+        while (it != gone.end() && it.key() == current.size()
+               && m_recorded.value(it.value()).hash() != current.hash()) {
+            ++it;
+        }
+        if (it == gone.end() || it.key() != current.size()) continue;
+
+        Operation& operation = m_operations[candidates.at(c)];
+        KDevelop::Path sourceUrl(projectPath, it.value());
+        operation.action = MoveFile;
+        operation.sourceProjectPath = it.value();
+        operation.sourceRelativeUrl = localPath.relativePath(sourceUrl);
+        operation.source = m_destBase;
+        operation.source.setPath(m_destBase.path() + "/" + operation.sourceRelativeUrl);
+        if (operation.size > 0) m_totalBytes -= operation.size;
+        --m_fileCount;
+        ++m_moveCount;
+        //a gone file is the source of one move only
+        gone.erase(it);
+    }
+}
+
+void UploadPlan::appendDeletions(const KDevelop::Path& projectPath, const KDevelop::Path& localPath)
+{
+    QSet<QString> moved;
+    Q_FOREACH (const Operation& operation, m_operations) {
+        if (operation.action == MoveFile) {
+            moved.insert(operation.sourceRelativeUrl);
+        }
+    }
+
+    QStringList gone;
+    Q_FOREACH (const QString& path, m_recorded.keys()) {
+        KDevelop::Path url(projectPath, path);
+        if (!QFile::exists(url.toLocalFile())) {
+            gone << localPath.relativePath(url);
+        }
+    }
+    Q_FOREACH (const QString& relativeUrl, m_remoteOnly) {
+        if (!QFile::exists(KDevelop::Path(localPath, relativeUrl).toLocalFile())) {
+            gone << relativeUrl;
+        }
+    }
+    std::sort(gone.begin(), gone.end());
+
+    QSet<QString> deleted;
+    Q_FOREACH (const QString& relativeUrl, gone) {
+        if (relativeUrl.isEmpty() || deleted.contains(relativeUrl) || moved.contains(relativeUrl)) continue;
+        bool inDeletedDirectory = false;
+        for (int slash = relativeUrl.indexOf('/'); slash != -1; slash = relativeUrl.indexOf('/', slash + 1)) {
+            if (deleted.contains(relativeUrl.left(slash))) {
+                inDeletedDirectory = true;
+                break;
+            }
+        }
+        if (inDeletedDirectory) continue;
+        deleted.insert(relativeUrl);
+
+        KDevelop::Path url(localPath, relativeUrl);
+        Operation operation;
+        operation.action = DeleteFile;
+        operation.reason = NoReason;
+        operation.url = url.toUrl();
+        operation.relativeUrl = relativeUrl;
+        operation.projectPath = projectPath.relativePath(url);
+        operation.dest = m_destBase;
+        operation.dest.setPath(m_destBase.path() + "/" + relativeUrl);
+        operation.size = -1;
+        operation.sourceIndex = -1;
+        append(operation);
+    }
+}
+
+UploadPlan UploadPlan::create(KDevelop::IProject* project, UploadProjectModel* model, const QList<QUrl>& files)
+{
+    UploadPlan plan;
+    plan.m_profileName = model->currentProfileName();
+    if (!model->stateStore()) return plan;
+    UploadDirtySet* dirtySet = UploadDirtySet::forProfile(project, model->profileConfigGroup());
+
+    KDevelop::Path localPath(model->currentProfileLocalUrl().adjusted(QUrl::StripTrailingSlash).path());
+    if (localPath.path().isEmpty()) {
+        localPath = project->path();
+    }
+    QUrl destBase = model->currentProfileUrl().adjusted(QUrl::StripTrailingSlash);
+
+    QList<QUrl> sorted = files;
+    std::sort(sorted.begin(), sorted.end());
+    Q_FOREACH (const QUrl& file, sorted) {
+        KDevelop::Path url(file);
+        if (!localPath.isParentOf(url) || !QFileInfo(url.toLocalFile()).isFile()) continue;
+
+        Operation operation;
+        operation.action = CopyFile;
+        operation.reason = NoReason;
+        operation.url = url.toUrl();
+        operation.relativeUrl = localPath.relativePath(url);
+        operation.projectPath = project->path().relativePath(url);
+        operation.dest = destBase;
+        operation.dest.setPath(destBase.path() + "/" + operation.relativeUrl);
+        operation.size = -1;
+        operation.sourceIndex = -1;
+        if (!dirtySet->isModified(operation.projectPath, url.toLocalFile())) continue;
+        plan.append(operation);
+    }
+    return plan;
+}
+
+void UploadPlan::append(const Operation& operation)
+{
+    switch (operation.action) {
+        case MakeDirectory:
+            ++m_directoryCount;
+            break;
+        case CopyFile:
+            ++m_fileCount;
+            if (operation.size > 0) m_totalBytes += operation.size;
+            break;
+        case MoveFile:
+            ++m_moveCount;
+            break;
+        case DuplicateFile:
+            ++m_duplicateCount;
+            if (operation.size > 0) m_savedBytes += operation.size;
+            break;
+        case DeleteFile:
+            ++m_deleteCount;
+            break;
+        case Skip:
+            ++m_skippedCount;
+            break;
+    }
+    m_operations.append(operation);
+}
+
+void UploadPlan::appendSourceDeletion(int operation)
+{
+    const Operation& move = m_operations.at(operation);
+    //the local url of the profile is where the relative urls start
+    KDevelop::Path localPath(move.url);
+    for (int depth = move.relativeUrl.count('/'); depth >= 0; --depth) {
+        localPath = localPath.parent();
+    }
+
+    Operation deletion;
+    deletion.action = DeleteFile;
+    deletion.reason = NoReason;
+    deletion.url = KDevelop::Path(localPath, move.sourceRelativeUrl).toUrl();
+    deletion.relativeUrl = move.sourceRelativeUrl;
+    deletion.projectPath = move.sourceProjectPath;
+    deletion.dest = move.source;
+    deletion.size = -1;
+    deletion.sourceIndex = -1;
+    append(deletion);
+}
+
+void UploadPlan::setSize(int operation, qint64 size)
+{
+    Operation& o = m_operations[operation];
+    if (o.action != CopyFile) return;
+    if (o.size > 0) m_totalBytes -= o.size;
+    o.size = size;
+    if (size > 0) m_totalBytes += size;
+}
+
+QStringList UploadPlan::report() const
+{
+    QStringList ret;
+    Q_FOREACH (const Operation& operation, m_operations) {
+        if (operation.action == MakeDirectory) {
+            ret << i18n("Would create directory in %1: %2", m_profileName, operation.relativeUrl);
+        } else if (operation.action == CopyFile) {
+            ret << i18n("Would upload to %1: %2 (%3)", m_profileName, operation.relativeUrl,
+                        operation.size >= 0 ? KIO::convertSize(operation.size) : i18n("unknown size"));
+        } else if (operation.action == DuplicateFile) {
+            ret << i18n("Would copy in %1: %2 to %3", m_profileName, operation.sourceRelativeUrl, operation.relativeUrl);
+        } else if (operation.action == MoveFile) {
+            ret << i18n("Would move in %1: %2 to %3", m_profileName, operation.sourceRelativeUrl, operation.relativeUrl);
+        } else if (operation.action == DeleteFile) {
+            ret << i18n("Would delete from %1: %2", m_profileName, operation.relativeUrl);
+        }
+    }
+    ret << i18np("Dry run for %2: 1 file to upload (%3), %4 directories, %5 skipped",
+                 "Dry run for %2: %1 files to upload (%3), %4 directories, %5 skipped",
+                 m_fileCount, m_profileName, KIO::convertSize(m_totalBytes), m_directoryCount, m_skippedCount);
+    if (m_duplicateCount) {
+        ret << i18np("Dry run for %2: 1 file to copy in the destination instead of uploading it, saves %3",
+                     "Dry run for %2: %1 files to copy in the destination instead of uploading them, saves %3",
+                     m_duplicateCount, m_profileName, KIO::convertSize(m_savedBytes));
+    }
+    if (m_moveCount) {
+        ret << i18np("Dry run for %2: 1 file to move instead of uploading it", "Dry run for %2: %1 files to move instead of uploading them",
+                     m_moveCount, m_profileName);
+    }
+    if (m_deleteCount) {
+        ret << i18np("Dry run for %2: 1 item to delete", "Dry run for %2: %1 items to delete",
+                     m_deleteCount, m_profileName);
+    }
+    return ret;
+}
+
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
@@ -0,0 +1,235 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+
+#ifndef UPLOADPLAN_H
+#define UPLOADPLAN_H
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QUrl>
+#include <QVector>
+
+#include "uploadfingerprint.h"
+
+namespace KDevelop {
+    class IProject;
+    class Path;
+}
+class UploadProjectModel;
+
+/**
+ * Ordered list of what an upload does, taken from the check states of an
+ * UploadProjectModel before the upload starts.
+ *
+ * Directories come before their contents. If the profile mirrors deletions
+ * the items to delete from the destination come last. Once created the operations
+ * don't change anymore, apart from the sizes of the files and the deletions of
+ * moves that fail, so UploadJob can run them without walking the model
+ * again and the same plan can be shown as a dry run.
+ */
+class UploadPlan
+{
+public:
+    enum Action {
+        MakeDirectory, ///< create the directory in the destination unless it exists
+        CopyFile,
+        MoveFile, ///< rename a file in the destination instead of uploading it, it was moved locally
+        DuplicateFile, ///< copy a file with the same content within the destination instead of uploading it
+        DeleteFile, ///< remove the file or directory from the destination, it is gone locally
+        Skip ///< the item is not uploaded, see SkipReason
+    };
+
+    enum SkipReason {
+        NoReason,
+        NotModified, ///< the item didn't change since the last upload
+        NotSelected ///< the user unchecked the item
+    };
+
+    struct Operation {
+        Action action;
+        SkipReason reason;
+        QUrl url; ///< local url of the item
+        QUrl dest; ///< destination url of the item
+        QString relativeUrl; ///< path relative to the local url of the profile, used for the log
+        QString projectPath; ///< path relative to the project, used for the upload state
+        qint64 size; ///< size of a file in bytes, -1 if unknown
+        QUrl source; ///< destination url a moved file is renamed from, or a duplicate is copied from
+        QString sourceRelativeUrl; ///< path of the source relative to the local url of the profile
+        QString sourceProjectPath; ///< path of the source relative to the project
+        int sourceIndex; ///< operation that uploads the source of a duplicate, -1 if it is in the destination already
+    };
+
+    /**
+     * Creates an empty plan
+     */
+    UploadPlan();
+
+    /**
+     * Progress of analyze(), shared with the thread that shows it
+     */
+    struct Progress {
+        QAtomicInt hashed; ///< files hashed so far
+        QAtomicInt toHash; ///< files to hash, grows while the analysis goes on
+        QAtomicInt canceled; ///< set to stop hashing, the plan is incomplete then
+    };
+
+    /**
+     * Creates the plan for the checked items of model with its current profile.
+     * The sizes of the files are unknown until they are set with setSize().
+     * If needsAnalysis(), analyze() has to run before the plan is used.
+     */
+    static UploadPlan create(KDevelop::IProject* project, UploadProjectModel* model);
+
+    /**
+     * Returns true if the plan created from a model still has to look at the files
+     */
+    bool needsAnalysis() const {
+        return m_deduplicate || m_mirrorDeletions;
+    }
+
+    /**
+     * Finds the files that are copied in the destination instead of uploaded, and if the profile
+     * mirrors deletions the items to delete: those that are gone locally and are recorded in the
+     * upload state or were found in the destination by a comparison. New files with the content
+     * of a gone one are renamed in the destination instead of uploaded.
+     *
+     * Stats and hashes local files, so it is meant to run on a worker thread. It only uses what
+     * create() took from the model and the upload state.
+     */
+    void analyze(Progress* progress);
+
+    /**
+     * Returns true if the worker for url copies files within the server, without the data
+     * going through this machine
+     */
+    static bool supportsRemoteCopy(const QUrl& url);
+
+    /**
+     * Creates the plan for a list of changed files with the current profile of model,
+     * used by continuous sync. Files outside the local url of the profile, files that
+     * are gone and files that didn't change since their last upload are left out.
+     * Missing directories are created by the upload when a copy fails.
+     */
+    static UploadPlan create(KDevelop::IProject* project, UploadProjectModel* model, const QList<QUrl>& files);
+
+    const QVector<Operation>& operations() const {
+        return m_operations;
+    }
+    bool isEmpty() const {
+        return m_operations.isEmpty();
+    }
+
+    /**
+     * Returns the name of the profile the plan was created for
+     */
+    QString profileName() const {
+        return m_profileName;
+    }
+
+    int fileCount() const {
+        return m_fileCount;
+    }
+    int directoryCount() const {
+        return m_directoryCount;
+    }
+    int skippedCount() const {
+        return m_skippedCount;
+    }
+    int deleteCount() const {
+        return m_deleteCount;
+    }
+    int moveCount() const {
+        return m_moveCount;
+    }
+    int duplicateCount() const {
+        return m_duplicateCount;
+    }
+
+    /**
+     * Returns the bytes that are not transferred because duplicates are copied in the destination
+     */
+    qint64 savedBytes() const {
+        return m_savedBytes;
+    }
+
+    /**
+     * Sets the size of the file copied by an operation, once it is known.
+     */
+    void setSize(int operation, qint64 size);
+
+    /**
+     * Appends the deletion of the item a move renames, for when the rename failed and
+     * the file is uploaded instead. The deletions stay last in the plan. Only call it
+     * if the user confirmed the deletion with the other ones.
+     * @param operation index of the MoveFile operation
+     */
+    void appendSourceDeletion(int operation);
+
+    /**
+     * Returns the sum of the known sizes of all files that are copied
+     */
+    qint64 totalBytes() const {
+        return m_totalBytes;
+    }
+
+    /**
+     * Returns what the plan would do as log lines, followed by a summary.
+     * Skipped items are only counted.
+     */
+    QStringList report() const;
+
+private:
+    void append(const Operation& operation);
+
+    /**
+     * Groups the files to upload by content. Only the first file of a group is uploaded, the others
+     * are copied from it in the destination. Files with the content of an unmodified file that is
+     * uploaded already are copied from that one. Only files whose size occurs more than once are hashed.
+     */
+    void deduplicate(const KDevelop::Path& projectPath, const KDevelop::Path& localPath, Progress* progress);
+
+    /**
+     * Turns the copies of new files into renames of gone files with the same content.
+     * Only files with the size of a gone file are hashed.
+     */
+    void detectMoves(const KDevelop::Path& projectPath, const KDevelop::Path& localPath, Progress* progress);
+
+    /**
+     * Appends the deletions of the items below localPath that are gone locally.
+     * Items inside a directory that is deleted are left out, they go with it,
+     * items that were moved are left out too.
+     */
+    void appendDeletions(const KDevelop::Path& projectPath, const KDevelop::Path& localPath);
+
+    QVector<Operation> m_operations;
+    QString m_profileName;
+    int m_fileCount;
+    int m_directoryCount;
+    int m_skippedCount;
+    int m_deleteCount;
+    int m_moveCount;
+    int m_duplicateCount;
+    qint64 m_savedBytes;
+    qint64 m_totalBytes;
+
+    //taken by create() for analyze(), cleared once it ran
+    bool m_deduplicate; ///< if the destination copies files within the server
+    bool m_mirrorDeletions;
+    QString m_projectDirectory;
+    QString m_localDirectory; ///< local url of the profile
+    QUrl m_destBase;
+    QHash<QString, UploadFingerprint> m_recorded; ///< upload state of the items below the local url, by project path
+    QSet<QString> m_unmodified; ///< recorded files the dirty set found unmodified
+    QStringList m_remoteOnly; ///< items found in the destination only, relative to it
+};
+
+#endif
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
@@ -22,6 +22,7 @@
 #include "ui_uploadpreferences.h"
 #include "uploadprofiledlg.h"
 #include "uploadprofileitem.h"
+#include "kdevuploadplugin.h"
 
 using namespace KDevelop;
 
@@ -70,6 +71,7 @@ void UploadPreferences::apply()
     m_model->submit();
     m_model->revert();
     ProjectConfigPage::apply();
+    static_cast<UploadPlugin*>(plugin())->projectProfilesChanged(project());
 }
 
 void UploadPreferences::defaults()
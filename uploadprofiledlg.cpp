@@ -76,6 +76,11 @@ int UploadProfileDlg::editProfile(UploadProfileItem* item)
     m_ui->lineProfileName->setText(item->text());
     m_ui->defaultProfile->setChecked(item->isDefault());
     m_ui->lineLocalPath->setText(item->localUrl().toString());
+    m_ui->concurrency->setValue(item->concurrency());
+    m_ui->connections->setValue(item->connections());
+    m_ui->continuousSync->setChecked(item->continuousSync());
+    m_ui->preserveAttributes->setChecked(item->preserveAttributes());
+    m_ui->mirrorDeletions->setChecked(item->mirrorDeletions());
     updateUrl(item->url());
 
     int result = exec();
@@ -84,6 +89,11 @@ int UploadProfileDlg::editProfile(UploadProfileItem* item)
         item->setUrl(currentUrl());
         QUrl localUrl = QUrl(m_ui->lineLocalPath->text());
         item->setLocalUrl(localUrl);
+        item->setConcurrency(m_ui->concurrency->value());
+        item->setConnections(m_ui->connections->value());
+        item->setContinuousSync(m_ui->continuousSync->isChecked());
+        item->setPreserveAttributes(m_ui->preserveAttributes->isChecked());
+        item->setMirrorDeletions(m_ui->mirrorDeletions->isChecked());
         item->setDefault(m_ui->defaultProfile->checkState() == Qt::Checked);
     }
     return result;
@@ -30,6 +30,26 @@ void UploadProfileItem::setLocalUrl(const QUrl& url)
 {
     setData(url, LocalUrlRole);
 }
+void UploadProfileItem::setConcurrency(int concurrency)
+{
+    setData(concurrency, ConcurrencyRole);
+}
+void UploadProfileItem::setConnections(int connections)
+{
+    setData(connections, ConnectionsRole);
+}
+void UploadProfileItem::setContinuousSync(bool continuousSync)
+{
+    setData(continuousSync, ContinuousSyncRole);
+}
+void UploadProfileItem::setPreserveAttributes(bool preserveAttributes)
+{
+    setData(preserveAttributes, PreserveAttributesRole);
+}
+void UploadProfileItem::setMirrorDeletions(bool mirrorDeletions)
+{
+    setData(mirrorDeletions, MirrorDeletionsRole);
+}
 
 void UploadProfileItem::setDefault(bool isDefault)
 {
@@ -63,6 +83,28 @@ QUrl UploadProfileItem::localUrl() const
 {
     return data(LocalUrlRole).value<QUrl>();
 }
+int UploadProfileItem::concurrency() const
+{
+    QVariant v = data(ConcurrencyRole);
+    return v.isValid() ? v.toInt() : static_cast<int>(DefaultConcurrency);
+}
+int UploadProfileItem::connections() const
+{
+    QVariant v = data(ConnectionsRole);
+    return v.isValid() ? v.toInt() : static_cast<int>(DefaultConnections);
+}
+bool UploadProfileItem::continuousSync() const
+{
+    return data(ContinuousSyncRole).toBool();
+}
+bool UploadProfileItem::preserveAttributes() const
+{
+    return data(PreserveAttributesRole).toBool();
+}
+bool UploadProfileItem::mirrorDeletions() const
+{
+    return data(MirrorDeletionsRole).toBool();
+}
 
 bool UploadProfileItem::isDefault() const
 {
@@ -22,15 +22,51 @@ class UploadProfileItem : public QStandardItem
         UrlRole = Qt::UserRole+1,
         IsDefaultRole,
         ProfileNrRole,
-        LocalUrlRole
+        LocalUrlRole,
+        ConcurrencyRole,
+        ConnectionsRole,
+        ContinuousSyncRole,
+        PreserveAttributesRole,
+        MirrorDeletionsRole
     };
 public:
+    enum {
+        DefaultConcurrency = 4, ///< parallel transfers used when a profile doesn't set one
+        DefaultConnections = 2 ///< connections kept open to the server when a profile doesn't set it
+    };
+
+
     UploadProfileItem();
     ~UploadProfileItem() override {}
 
     void setUrl(const QUrl& url);
     void setLocalUrl(const QUrl& url);
 
+    /**
+     * Set the number of copy/mkdir jobs that may run at the same time
+     */
+    void setConcurrency(int concurrency);
+
+    /**
+     * Set the number of connections to the server that are kept open for the profile
+     */
+    void setConnections(int connections);
+
+    /**
+     * Set if changed files are uploaded to this profile automatically
+     */
+    void setContinuousSync(bool continuousSync);
+
+    /**
+     * Set if uploaded files get the modification time and permissions of the local file
+     */
+    void setPreserveAttributes(bool preserveAttributes);
+
+    /**
+     * Set if files that were deleted locally are deleted in the destination too
+     */
+    void setMirrorDeletions(bool mirrorDeletions);
+
     /**
      * Set if this item is the default upload-profile.
      * Sets default to false for all other items in this model
@@ -44,6 +80,11 @@ public:
 
     QUrl url() const;
     QUrl localUrl() const;
+    int concurrency() const;
+    int connections() const;
+    bool continuousSync() const;
+    bool preserveAttributes() const;
+    bool mirrorDeletions() const;
     bool isDefault() const;
 
     /**
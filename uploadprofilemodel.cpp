@@ -17,6 +17,8 @@
 #include <interfaces/iproject.h>
 
 #include "uploadprofileitem.h"
+#include "uploadstatestore.h"
+#include "uploaddirtyset.h"
 
 UploadProfileModel::UploadProfileModel(QObject* parent)
     : QStandardItemModel(parent)
@@ -69,6 +71,11 @@ void UploadProfileModel::revert()
             QUrl url = group.group(g).readEntry("url", QUrl());
             QUrl localUrl = group.group(g).readEntry("localUrl", QUrl());
             QString name = group.group(g).readEntry("name", QString());
+            int concurrency = group.group(g).readEntry("concurrency", static_cast<int>(UploadProfileItem::DefaultConcurrency));
+            int connections = group.group(g).readEntry("connections", static_cast<int>(UploadProfileItem::DefaultConnections));
+            bool continuousSync = group.group(g).readEntry("continuousSync", false);
+            bool preserveAttributes = group.group(g).readEntry("preserveAttributes", false);
+            bool mirrorDeletions = group.group(g).readEntry("mirrorDeletions", false);
             UploadProfileItem* i = uploadItem(row);
             if (!i) {
                 i = new UploadProfileItem();
@@ -77,6 +84,11 @@ void UploadProfileModel::revert()
             i->setText(name);
             i->setUrl(url);
             i->setLocalUrl(localUrl);
+            i->setConcurrency(concurrency);
+            i->setConnections(connections);
+            i->setContinuousSync(continuousSync);
+            i->setPreserveAttributes(preserveAttributes);
+            i->setMirrorDeletions(mirrorDeletions);
             i->setProfileNr(g.mid(7)); //group-name
             i->setDefault(i->profileNr() == defProfile);
             ++row;
@@ -92,6 +104,8 @@ bool UploadProfileModel::submit()
     KConfigGroup group = m_project->projectConfiguration()->group("Upload");
     Q_FOREACH (QString i, m_deltedProfileNrs) {
         group.group("Profile" + i).deleteGroup();
+        UploadDirtySet::discard(m_project, "Profile" + i);
+        UploadStateStore::discard(m_project, "Profile" + i);
     }
 
     int maxProfileNr = 0;
@@ -112,6 +126,16 @@ bool UploadProfileModel::submit()
             profileGroup.writeEntry("url", item->url().toString());
             profileGroup.writeEntry("localUrl", item->localUrl().toString());
             profileGroup.writeEntry("name", item->text());
+            if (profileGroup.readEntry("concurrency", item->concurrency()) != item->concurrency()) {
+                //user chose a new value, forget what the uploads learned
+                profileGroup.deleteEntry("concurrencyLimit");
+                profileGroup.deleteEntry("concurrencyCeiling");
+            }
+            profileGroup.writeEntry("concurrency", item->concurrency());
+            profileGroup.writeEntry("connections", item->connections());
+            profileGroup.writeEntry("continuousSync", item->continuousSync());
+            profileGroup.writeEntry("preserveAttributes", item->preserveAttributes());
+            profileGroup.writeEntry("mirrorDeletions", item->mirrorDeletions());
             if (item->isDefault()) {
                 defaultProfileNr = item->profileNr();
             }
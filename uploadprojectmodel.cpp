@@ -10,18 +10,37 @@
 #include "uploadprojectmodel.h"
 
 #include <kconfiggroup.h>
-#include <kfileitem.h>
+#include <KLocalizedString>
 #include <QDir>
+#include <QVector>
 #include "kdevuploaddebug.h"
 
+#include <interfaces/icore.h>
+#include <interfaces/idocument.h>
+#include <interfaces/idocumentcontroller.h>
 #include <interfaces/iproject.h>
+#include <serialization/indexedstring.h>
 #include <util/path.h>
 
 #include <project/projectmodel.h>
 
+#include "uploadprofileitem.h"
+#include "uploadstatestore.h"
+#include "uploaddirtyset.h"
+
 UploadProjectModel::UploadProjectModel(KDevelop::IProject* project, QObject *parent)
-    : QSortFilterProxyModel(parent), m_project(project), m_rootItem(nullptr)
+    : QSortFilterProxyModel(parent), m_project(project), m_stateStore(nullptr), m_dirtySet(nullptr), m_rootItem(nullptr),
+      m_evaluateAll(false)
 {
+    //cached check states of removed or moved items are useless
+    connect(this, SIGNAL(rowsInserted(QModelIndex, int, int)), SLOT(clearCheckCache()));
+    connect(this, SIGNAL(rowsRemoved(QModelIndex, int, int)), SLOT(clearCheckCache()));
+    connect(this, SIGNAL(rowsMoved(QModelIndex, int, int, QModelIndex, int)), SLOT(clearCheckCache()));
+    connect(this, SIGNAL(layoutChanged()), SLOT(clearCheckCache()));
+    connect(this, SIGNAL(modelReset()), SLOT(clearCheckCache()));
+
+    connect(KDevelop::ICore::self()->documentController(), SIGNAL(documentSaved(KDevelop::IDocument*)),
+            this, SLOT(documentSaved(KDevelop::IDocument*)));
 }
 
 UploadProjectModel::~UploadProjectModel()
@@ -63,68 +82,270 @@ Qt::ItemFlags UploadProjectModel::flags(const QModelIndex & index) const
 
 QVariant UploadProjectModel::data(const QModelIndex & indx, int role) const
 {
-     if (indx.isValid() && role == Qt::CheckStateRole) {
+    if (indx.isValid() && role == Qt::DisplayRole && m_profileConfigGroup.isValid() && isScanning(indx)) {
+        return i18nc("file name while its modification state is determined", "%1 (scanning...)",
+                     QSortFilterProxyModel::data(indx, role).toString());
+    }
+    if (indx.isValid() && role == Qt::ToolTipRole && m_profileConfigGroup.isValid()
+        && !m_checkCache.contains(item(indx)) && isSummarized(indx) && summaryCheckState(indx) != Qt::Unchecked) {
+        return i18n("May contain changes, expand the folder to see them");
+    }
+    if (indx.isValid() && role == Qt::CheckStateRole) {
         KDevelop::ProjectBaseItem* i = item(indx);
-        if (i->file() && m_profileConfigGroup.isValid()) {
-            if (m_checkStates.contains(indx)) {
-                return m_checkStates.value(indx);
+        if ((i->file() || i->folder()) && m_profileConfigGroup.isValid()) {
+            return checkState(indx);
+        } else {
+            return QVariant();
+        }
+    }
+    return QSortFilterProxyModel::data(indx, role);
+}
+
+Qt::CheckState UploadProjectModel::checkState(const QModelIndex& indx) const
+{
+    KDevelop::ProjectBaseItem* i = item(indx);
+    QHash<KDevelop::ProjectBaseItem*, CheckNode>::const_iterator it = m_checkCache.constFind(i);
+    if (it != m_checkCache.constEnd()) {
+        return it.value().state;
+    }
+
+    CheckNode node;
+    int rows = rowCount(indx);
+    if (i->folder() && rows) {
+        if (!m_evaluateAll && isSummarized(indx)) {
+            //collapsed, don't look at the subtree until it is expanded
+            return summaryCheckState(indx);
+        }
+        bool complete = true;
+        for (int j = 0; j < rows; j++) {
+            QModelIndex child = index(j, 0, indx);
+            KDevelop::ProjectBaseItem* c = item(child);
+            node.count(c->file() || c->folder() ? checkState(child) : Qt::Unchecked, 1);
+            if (!m_checkCache.contains(c) && (c->file() || c->folder())) {
+                //summarized below, the counters would be wrong once it is expanded
+                complete = false;
+            }
+        }
+        node.state = node.aggregate();
+        if (!complete) {
+            return node.state;
+        }
+    } else {
+        node.state = leafCheckState(indx);
+    }
+    m_checkCache.insert(i, node);
+    return node.state;
+}
+
+bool UploadProjectModel::isSummarized(const QModelIndex& indx) const
+{
+    KDevelop::ProjectBaseItem* i = item(indx);
+    if (!i->folder() || !rowCount(indx) || m_expanded.contains(i->indexedPath().index())) return false;
+
+    //a user selection below it needs the real state
+    return !m_overriddenFolders.contains(i->indexedPath().str());
+}
+
+void UploadProjectModel::addOverride(uint id, Qt::CheckState state)
+{
+    m_checkStates.insert(id, state);
+    QString path = KDevelop::IndexedString::fromIndex(id).str();
+    int slash;
+    while ((slash = path.lastIndexOf('/')) > 0) {
+        path.truncate(slash);
+        if (m_overriddenFolders.contains(path)) break; //and everything above it
+        m_overriddenFolders.insert(path);
+    }
+}
+
+Qt::CheckState UploadProjectModel::summaryCheckState(const QModelIndex& indx) const
+{
+    QString directory = m_project->path().relativePath(item(indx)->path());
+    return m_dirtySet && m_dirtySet->containsBelow(directory) ? Qt::PartiallyChecked : Qt::Unchecked;
+}
+
+Qt::CheckState UploadProjectModel::evaluatedCheckState(const QModelIndex& indx) const
+{
+    m_evaluateAll = true;
+    Qt::CheckState state = checkState(indx);
+    m_evaluateAll = false;
+    return state;
+}
+
+void UploadProjectModel::setExpanded(const QModelIndex& indx, bool expanded)
+{
+    KDevelop::ProjectBaseItem* i = item(indx);
+    if (!i || !i->folder()) return;
+    if (expanded) {
+        m_expanded.insert(i->indexedPath().index());
+        //the folder follows its children now
+        refreshAncestors(indx);
+    } else {
+        //a state that is evaluated already stays
+        m_expanded.remove(i->indexedPath().index());
+    }
+}
+
+Qt::CheckState UploadProjectModel::leafCheckState(const QModelIndex& indx) const
+{
+    KDevelop::ProjectBaseItem* i = item(indx);
+    if (i->file()) {
+        if (m_checkStates.contains(i->indexedPath().index())) {
+            return m_checkStates.value(i->indexedPath().index());
+        } else {
+            qCDebug(KDEVUPLOAD) << "project folder" << m_project->path().path() << "file" << i << i->file();
+            qCDebug(KDEVUPLOAD) << "file url" << i->file()->path().path();
+            QString url = m_project->path().relativePath(i->file()->path());
+            qCDebug(KDEVUPLOAD) << "resulting url" << url;
+            if (m_dirtySet->isScanning(i->indexedPath())) {
+                //shown as scanning, updated when the result comes in
+                return Qt::Unchecked;
+            }
+            //files added since the scan count as modified until their result comes in
+            return m_dirtySet->isModified(url, i->file()->path().toLocalFile()) ? Qt::Checked : Qt::Unchecked;
+        }
+    } else if (i->folder()) {
+        //empty folder - should be uploaded too
+        if (m_checkStates.contains(i->indexedPath().index())) {
+            return m_checkStates.value(i->indexedPath().index());
+        } else {
+            //don't check for ModificationTime as we do for files
+            QString url = m_project->path().relativePath(i->folder()->path());
+            QDateTime uploadTime(m_stateStore->uploadTime(url));
+            if (uploadTime.isValid()) {
+                return Qt::Unchecked;
             } else {
-                qCDebug(KDEVUPLOAD) << "project folder" << m_project->path().path() << "file" << i << i->file();
-                qCDebug(KDEVUPLOAD) << "file url" << i->file()->path().path();
-                QString url = m_project->path().relativePath(i->file()->path());
-                qCDebug(KDEVUPLOAD) << "resulting url" << url;
-                QDateTime uploadTime(m_profileConfigGroup.readEntry(url, QDateTime()));
-                if (uploadTime.isValid()) {
-                    KFileItem fileItem(i->file()->path().toUrl());
-                    QDateTime modTime = fileItem.time(KFileItem::ModificationTime);
-                    if (modTime > uploadTime) {
-                        return Qt::Checked;
-                    } else {
-                        return Qt::Unchecked;
-                    }
-                } else {
-                    return Qt::Checked;
-                }
+                return Qt::Checked;
             }
-        } else if (i->folder() && m_profileConfigGroup.isValid()) {
-            if (!rowCount(indx)) {
-                //empty folder - should be uploaded too
-                if (m_checkStates.contains(indx)) {
-                    return m_checkStates.value(indx);
-                } else {
-                    //don't check for ModificationTime as we do for files
-                    QString url = m_project->path().relativePath(i->folder()->path());
-                    QDateTime uploadTime(m_profileConfigGroup.readEntry(url, QDateTime()));
-                    if (uploadTime.isValid()) {
-                        return Qt::Unchecked;
-                    } else {
-                        return Qt::Checked;
-                    }
-                }
+        }
+    }
+    return Qt::Unchecked;
+}
+
+void UploadProjectModel::CheckNode::count(Qt::CheckState s, int n)
+{
+    if (s == Qt::Checked) {
+        checked += n;
+    } else if (s == Qt::Unchecked) {
+        unchecked += n;
+    } else {
+        partial += n;
+    }
+}
+
+Qt::CheckState UploadProjectModel::CheckNode::aggregate() const
+{
+    if (partial || (checked && unchecked)) {
+        return Qt::PartiallyChecked;
+    } else if (checked) {
+        return Qt::Checked;
+    }
+    return Qt::Unchecked;
+}
+
+void UploadProjectModel::updateCheckState(const QModelIndex& indx, Qt::CheckState state)
+{
+    QHash<KDevelop::ProjectBaseItem*, CheckNode>::iterator it = m_checkCache.find(item(indx));
+    if (it == m_checkCache.end()) {
+        //never asked for, so none of the parents is cached either
+        emit dataChanged(indx, indx);
+        return;
+    }
+    Qt::CheckState oldState = it.value().state;
+    it.value().state = state;
+    if (oldState == state) return;
+    emit dataChanged(indx, indx);
+
+    //adjust the counters of the parents as long as their state changes too
+    QModelIndex i = indx.parent();
+    while (i.isValid() && oldState != state) {
+        it = m_checkCache.find(item(i));
+        if (it == m_checkCache.end()) {
+            //next to a summarized folder, computed again when asked
+            refreshAncestors(i);
+            break;
+        }
+        it.value().count(oldState, -1);
+        it.value().count(state, 1);
+        oldState = it.value().state;
+        state = it.value().aggregate();
+        it.value().state = state;
+        if (oldState != state) {
+            emit dataChanged(i, i);
+        }
+        i = i.parent();
+    }
+}
+
+void UploadProjectModel::refreshAncestors(const QModelIndex& indx)
+{
+    for (QModelIndex a = indx; a.isValid(); a = a.parent()) {
+        m_checkCache.remove(item(a));
+        emit dataChanged(a, a);
+    }
+}
+
+void UploadProjectModel::invalidate(const QModelIndex& indx)
+{
+    KDevelop::ProjectBaseItem* i = item(indx);
+    if (!m_checkCache.contains(i)) return;
+    if (i->folder() && rowCount(indx)) return; //follows the children
+    updateCheckState(indx, leafCheckState(indx));
+}
+
+void UploadProjectModel::documentSaved(KDevelop::IDocument* document)
+{
+    if (!m_profileConfigGroup.isValid()) return;
+    Q_FOREACH (KDevelop::ProjectFileItem* file, m_project->filesForPath(KDevelop::IndexedString(document->url()))) {
+        QModelIndex indx = mapFromSource(file->index());
+        if (indx.isValid()) {
+            invalidate(indx);
+        }
+    }
+}
+
+void UploadProjectModel::dirtySetChanged(const QList<KDevelop::IndexedString>& files)
+{
+    QSet<KDevelop::ProjectBaseItem*> refreshed;
+    Q_FOREACH (const KDevelop::IndexedString& path, files) {
+        Q_FOREACH (KDevelop::ProjectFileItem* file, m_project->filesForPath(path)) {
+            if (!m_checkCache.contains(file)) {
+                //never shown, but the hint of the visible folders above it may change
+                refreshVisibleAncestors(file, &refreshed);
+                continue;
             }
-            bool allChecked = true;
-            bool noneChecked = true;
-            for (int j = 0; j < rowCount(indx); j++) {
-                Qt::CheckState s = static_cast<Qt::CheckState>(data(index(j, 0, indx), role).toInt());
-                if (s == Qt::Checked) {
-                    noneChecked = false;
-                } else if (s == Qt::Unchecked) {
-                    allChecked = false;
-                } else {
-                    return Qt::PartiallyChecked;
-                }
+            QModelIndex indx = mapFromSource(file->index());
+            if (indx.isValid()) {
+                invalidate(indx);
+                //the scanning placeholder is gone even if the state stayed
+                emit dataChanged(indx, indx);
             }
-            if (allChecked) {
-                return Qt::Checked;
-            } else if (noneChecked) {
-                return Qt::Unchecked;
+        }
+    }
+}
+
+void UploadProjectModel::refreshVisibleAncestors(KDevelop::ProjectBaseItem* item, QSet<KDevelop::ProjectBaseItem*>* refreshed)
+{
+    QList<KDevelop::ProjectBaseItem*> ancestors;
+    for (KDevelop::ProjectBaseItem* a = item->parent(); a; a = a->parent()) {
+        ancestors.prepend(a);
+    }
+    //from the top down to the first collapsed folder, nothing below it is shown
+    Q_FOREACH (KDevelop::ProjectBaseItem* a, ancestors) {
+        if (!refreshed->contains(a)) {
+            refreshed->insert(a);
+            QModelIndex indx = mapFromSource(a->index());
+            if (indx.isValid()) {
+                emit dataChanged(indx, indx);
             }
-            return Qt::PartiallyChecked;
-        } else {
-            return QVariant();
         }
+        if (!m_expanded.contains(a->indexedPath().index())) break;
     }
-    return QSortFilterProxyModel::data(indx, role);
+}
+
+void UploadProjectModel::clearCheckCache()
+{
+    m_checkCache.clear();
 }
 
 bool UploadProjectModel::setData ( const QModelIndex & indx, const QVariant & value, int role)
@@ -133,25 +354,20 @@ bool UploadProjectModel::setData ( const QModelIndex & indx, const QVariant & va
         KDevelop::ProjectBaseItem* i = item(indx);
         if (i->file()) {
             Qt::CheckState s = static_cast<Qt::CheckState>(value.toInt());
-            m_checkStates.insert(indx, s);
+            addOverride(i->indexedPath().index(), s);
 
-            emit dataChanged(indx, indx);
+            updateCheckState(indx, s);
             return true;
         } else if (i->folder()) {
             if (!rowCount(indx)) {
                 //empty folder - should be uploaded too
                 Qt::CheckState s = static_cast<Qt::CheckState>(value.toInt());
-                m_checkStates.insert(indx, s);
-                emit dataChanged(indx, indx);
+                addOverride(i->indexedPath().index(), s);
+                updateCheckState(indx, s);
             } else {
                 //recursive check/uncheck
-                QModelIndex i = indx;
-                while((i = nextRecursionIndex(i, indx)).isValid()) {
-                    setData(i, value, role);
-                }
+                setCheckStates(indx, value.toInt() == Qt::Unchecked ? UncheckAll : CheckAll);
             }
-
-            emit dataChanged(indx, indx);
             return true;
         }
     }
@@ -160,17 +376,84 @@ bool UploadProjectModel::setData ( const QModelIndex & indx, const QVariant & va
 
 void UploadProjectModel::setProfileConfigGroup(const KConfigGroup& group)
 {
+    saveCheckStates();
+
     beginResetModel();
     m_profileConfigGroup = group;
+    m_stateStore = group.isValid() ? UploadStateStore::forProfile(m_project, group) : nullptr;
+    if (m_dirtySet) {
+        disconnect(m_dirtySet, nullptr, this, nullptr);
+    }
+    m_dirtySet = group.isValid() ? UploadDirtySet::forProfile(m_project, group) : nullptr;
+    if (m_dirtySet) {
+        connect(m_dirtySet, SIGNAL(changed(QList<KDevelop::IndexedString>)),
+                this, SLOT(dirtySetChanged(QList<KDevelop::IndexedString>)));
+    }
     m_checkStates.clear();
+    m_overriddenFolders.clear();
+    m_checkCache.clear();
+    m_expanded.clear();
+    m_remoteOnly.clear();
+    if (rememberCheckStates()) {
+        QHash<QString, Qt::CheckState> selection = m_stateStore->selection();
+        for (QHash<QString, Qt::CheckState>::const_iterator it = selection.constBegin(); it != selection.constEnd(); ++it) {
+            KDevelop::IndexedString path(KDevelop::Path(m_project->path(), it.key()).pathOrUrl());
+            addOverride(path.index(), it.value());
+        }
+    }
     endResetModel();
 }
 
+bool UploadProjectModel::rememberCheckStates() const
+{
+    return m_stateStore && m_profileConfigGroup.readEntry("rememberSelection", false);
+}
+
+void UploadProjectModel::setRememberCheckStates(bool remember)
+{
+    if (!m_profileConfigGroup.isValid()) return;
+    m_profileConfigGroup.writeEntry("rememberSelection", remember);
+    m_profileConfigGroup.sync();
+    if (!remember) {
+        m_stateStore->setSelection(QHash<QString, Qt::CheckState>());
+    }
+}
+
+bool UploadProjectModel::isCheckStateOverridden(const QModelIndex& index) const
+{
+    KDevelop::ProjectBaseItem* i = item(index);
+    return i && m_checkStates.contains(i->indexedPath().index());
+}
+
+bool UploadProjectModel::isScanning(const QModelIndex& index) const
+{
+    KDevelop::ProjectBaseItem* i = item(index);
+    return i && i->file() && m_dirtySet && m_dirtySet->isScanning(i->indexedPath())
+        && !m_checkStates.contains(i->indexedPath().index());
+}
+
+void UploadProjectModel::saveCheckStates()
+{
+    if (!rememberCheckStates()) return;
+
+    QHash<QString, Qt::CheckState> selection;
+    Q_FOREACH (uint id, m_checkStates.ids()) {
+        KDevelop::Path path(KDevelop::IndexedString::fromIndex(id).str());
+        selection.insert(m_project->path().relativePath(path), m_checkStates.value(id));
+    }
+    m_stateStore->setSelection(selection);
+}
+
 KConfigGroup UploadProjectModel::profileConfigGroup() const
 {
     return m_profileConfigGroup;
 }
 
+UploadStateStore* UploadProjectModel::stateStore() const
+{
+    return m_stateStore;
+}
+
 KDevelop::ProjectModel* UploadProjectModel::projectModel() const
 {
     return qobject_cast<KDevelop::ProjectModel*>(sourceModel());
@@ -209,6 +492,8 @@ void UploadProjectModel::setRootItem(KDevelop::ProjectBaseItem* item)
 {
     beginResetModel();
     m_rootItem = item;
+    m_checkCache.clear();
+    m_expanded.clear();
     endResetModel();
 }
 
@@ -227,32 +512,122 @@ QUrl UploadProjectModel::currentProfileLocalUrl()
     return m_profileConfigGroup.readEntry("localUrl", QUrl());
 }
 
+int UploadProjectModel::currentProfileConcurrency()
+{
+    return qMax(1, m_profileConfigGroup.readEntry("concurrency", static_cast<int>(UploadProfileItem::DefaultConcurrency)));
+}
+
 void UploadProjectModel::checkAll()
 {
-    setData(index(0, 0), Qt::Checked, Qt::CheckStateRole);
+    setCheckStates(QModelIndex(), CheckAll);
 }
 
 void UploadProjectModel::checkModified()
 {
-    QMapIterator<QModelIndex, Qt::CheckState> i(m_checkStates);
+    //the states come from the dirty set again, only the shown items need an update
+    m_checkStates.clear();
+    m_overriddenFolders.clear();
+    m_checkCache.clear();
+    refreshShown();
+}
+
+void UploadProjectModel::checkFiles(const QSet<QString>& paths, const QSet<QString>& compared)
+{
     m_checkStates.clear();
-    while (i.hasNext()) {
-        i.next();
-        emit dataChanged(i.key(), i.key());
+    m_overriddenFolders.clear();
+    m_checkCache.clear();
+    //only files whose state isn't the one from the dirty set need a selection,
+    //collapsed folders without one keep their summary
+    Q_FOREACH (const QString& path, compared) {
+        KDevelop::IndexedString file(KDevelop::Path(m_project->path(), path).pathOrUrl());
+        bool checked = paths.contains(path);
+        if (!m_dirtySet->isScanned(file) || m_dirtySet->contains(path) != checked) {
+            addOverride(file.index(), checked ? Qt::Checked : Qt::Unchecked);
+        }
+    }
+    refreshShown();
+}
+
+void UploadProjectModel::setRemoteOnly(const QStringList& relativeUrls)
+{
+    m_remoteOnly = relativeUrls;
+}
+
+void UploadProjectModel::refreshShown()
+{
+    QList<QModelIndex> parents;
+    parents << QModelIndex();
+    Q_FOREACH (uint id, m_expanded) {
+        Q_FOREACH (KDevelop::ProjectFolderItem* folder, m_project->foldersForPath(KDevelop::IndexedString::fromIndex(id))) {
+            QModelIndex indx = mapFromSource(folder->index());
+            if (indx.isValid()) {
+                parents << indx;
+            }
+        }
+    }
+    Q_FOREACH (const QModelIndex& parent, parents) {
+        if (rowCount(parent)) {
+            emit dataChanged(index(0, 0, parent), index(rowCount(parent) - 1, 0, parent));
+        }
     }
 }
 
 void UploadProjectModel::checkInvert()
 {
-    QModelIndex index;
-    while((index = nextRecursionIndex(index)).isValid()) {
-        KDevelop::ProjectBaseItem* i = item(index);
-        if (!(i->folder() && rowCount(index) > 0)) {
-            //invert files and empty folders
-            Qt::CheckState v = static_cast<Qt::CheckState>(data(index, Qt::CheckStateRole).toInt());
-            if (v == Qt::Unchecked) v = Qt::Checked; else v = Qt::Unchecked;
-            setData(index, v, Qt::CheckStateRole);
+    setCheckStates(QModelIndex(), Invert);
+}
+
+void UploadProjectModel::setCheckStates(const QModelIndex& root, BulkCheck operation)
+{
+    QVector<QModelIndex> parents; ///< indexes whose children changed, for one dataChanged per parent
+    if (!root.isValid() || rowCount(root)) {
+        parents << root;
+    }
+
+    //all new states are decided before the first one is stored, an insert makes the next lookup merge the overrides
+    QVector<QPair<KDevelop::ProjectBaseItem*, Qt::CheckState> > states;
+    QModelIndex i = root;
+    while ((i = nextRecursionIndex(i, root)).isValid()) {
+        KDevelop::ProjectBaseItem* it = item(i);
+        if (rowCount(i)) {
+            //counters are rebuilt from the children when asked for
+            m_checkCache.remove(it);
+            parents << i;
+            continue;
         }
+        if (!(it->file() || it->folder())) continue;
+
+        Qt::CheckState s = Qt::Unchecked;
+        switch (operation) {
+            case CheckAll:
+                s = Qt::Checked;
+                break;
+            case UncheckAll:
+                s = Qt::Unchecked;
+                break;
+            case Invert:
+                s = checkState(i) == Qt::Unchecked ? Qt::Checked : Qt::Unchecked;
+                break;
+        }
+        states << qMakePair(it, s);
+    }
+    for (int n = 0; n < states.count(); ++n) {
+        addOverride(states.at(n).first->indexedPath().index(), states.at(n).second);
+        CheckNode node;
+        node.state = states.at(n).second;
+        m_checkCache.insert(states.at(n).first, node);
+    }
+
+    //the root and everything above it aggregate the changed states
+    for (QModelIndex a = root; a.isValid(); a = a.parent()) {
+        m_checkCache.remove(item(a));
+    }
+
+    Q_FOREACH (const QModelIndex& parent, parents) {
+        emit dataChanged(index(0, 0, parent), index(rowCount(parent) - 1, 0, parent));
+    }
+    for (QModelIndex a = root; a.isValid(); a = a.parent()) {
+        emit dataChanged(a, a);
     }
 }
 
@@ -12,22 +12,31 @@
 #define UPLOADPROJECTMODEL_H
 
 #include <QSortFilterProxyModel>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
 
 #include <ksharedconfig.h>
 #include <kconfiggroup.h>
 
+#include "uploadcheckoverrides.h"
+
 namespace KDevelop {
+    class IDocument;
+    class IndexedString;
     class IProject;
     class ProjectModel;
     class ProjectBaseItem;
 }
 class QUrl;
+class UploadStateStore;
+class UploadDirtySet;
 
 /**
  * ProxyModel that adds checkboxes for upload status to the ProjectModel.
  *
- * Reads out the modified time of files and compares it with the last upload time
- * to automatically select changed items.
+ * Selects the files in the dirty set of the profile, which compares them
+ * with the fingerprint recorded when they were uploaded.
  */
 class UploadProjectModel : public QSortFilterProxyModel
 {
@@ -53,6 +62,11 @@ public:
      */
     KConfigGroup profileConfigGroup() const;
 
+    /**
+     * Returns the store with upload times and fingerprints of the current upload-profile.
+     */
+    UploadStateStore* stateStore() const;
+
     /**
      * Convenience function that returns the casted project-model.
      */
@@ -73,6 +87,68 @@ public:
 
     void setRootItem(KDevelop::ProjectBaseItem* item);
 
+    /**
+     * Returns true if the user selection is kept for the current profile between dialog sessions
+     */
+    bool rememberCheckStates() const;
+    void setRememberCheckStates(bool remember);
+
+    /**
+     * Returns true if the user changed the check state of the item, instead of it following
+     * the modification state
+     */
+    bool isCheckStateOverridden(const QModelIndex& index) const;
+
+    /**
+     * Returns true if the file is not scanned yet, its check state is unknown and shown
+     * as unchecked with a placeholder until the scan got to it
+     */
+    bool isScanning(const QModelIndex& index) const;
+
+    /**
+     * Tells the model which folders the view shows expanded. The check states of collapsed
+     * folders aren't evaluated, they show a hint from the dirty set until they are expanded.
+     */
+    void setExpanded(const QModelIndex& index, bool expanded);
+
+    /**
+     * Returns the check state of an item, evaluating the whole subtree of a collapsed folder.
+     * Used by the upload, the view only gets the hint.
+     */
+    Qt::CheckState evaluatedCheckState(const QModelIndex& index) const;
+
+    /**
+     * Checks exactly the given files of the compared ones, eg. the files that differ from the destination.
+     * User selections are dropped, the files that weren't compared get their modified state.
+     * @param paths paths relative to the project directory
+     */
+    void checkFiles(const QSet<QString>& paths, const QSet<QString>& compared);
+
+    /**
+     * Sets the items a comparison found in the destination that don't exist locally,
+     * they are deleted by the upload if the profile mirrors deletions
+     * @param relativeUrls paths relative to the local url of the profile
+     */
+    void setRemoteOnly(const QStringList& relativeUrls);
+
+    /**
+     * Returns the items in the destination that don't exist locally, as far as the last comparison knows
+     */
+    QStringList remoteOnly() const {
+        return m_remoteOnly;
+    }
+
+    /**
+     * Stores the user selection in the upload state of the current profile, if it is remembered
+     */
+    void saveCheckStates();
+
+    /**
+     * Recomputes the check state of a file or empty folder, eg. after it changed on disk.
+     * The folders above it are updated incrementally.
+     */
+    void invalidate(const QModelIndex& index);
+
     /**
      * Returns the name of the current Upload Profile (which is set through setProfileConfigGroup)
      */
@@ -88,6 +164,11 @@ public:
      */
     QUrl currentProfileLocalUrl();
 
+    /**
+     * Returns how many transfers of the current Upload Profile may run in parallel
+     */
+    int currentProfileConcurrency();
+
 public Q_SLOTS:
     /**
      * Checks all items
@@ -104,11 +185,114 @@ public Q_SLOTS:
      */
     void checkInvert();
 
+private Q_SLOTS:
+    /**
+     * Invalidates the check state of the saved file
+     */
+    void documentSaved(KDevelop::IDocument* document);
+
+    /**
+     * Updates files the dirty set scanned or whose modified state changed
+     */
+    void dirtySetChanged(const QList<KDevelop::IndexedString>& files);
+
+    /**
+     * Forgets all cached check states, called when the tree structure changes
+     */
+    void clearCheckCache();
+
 private:
+    /**
+     * Bulk operations on the check states of a subtree
+     */
+    enum BulkCheck {
+        CheckAll,
+        UncheckAll,
+        Invert
+    };
+
+    /**
+     * Applies a bulk operation to all files and empty folders below root (the whole tree if root is invalid)
+     * in one pass. Emits one dataChanged per changed parent instead of one per item.
+     */
+    void setCheckStates(const QModelIndex& root, BulkCheck operation);
+
+    /**
+     * Cached check state of an item. Folders with children also count the states of their children,
+     * so a change of one child updates the folder in O(1).
+     */
+    struct CheckNode {
+        CheckNode() : state(Qt::Unchecked), checked(0), unchecked(0), partial(0) {}
+        void count(Qt::CheckState s, int n);
+        Qt::CheckState aggregate() const;
+
+        Qt::CheckState state;
+        int checked;
+        int unchecked;
+        int partial;
+    };
+
+    /**
+     * Returns the check state of an item, from the cache if possible
+     */
+    Qt::CheckState checkState(const QModelIndex& index) const;
+
+    /**
+     * Computes the check state of a file or empty folder from the user selection or the upload state
+     */
+    Qt::CheckState leafCheckState(const QModelIndex& index) const;
+
+    /**
+     * Stores a check state the user selected and records the folders above it
+     */
+    void addOverride(uint id, Qt::CheckState state);
+
+    /**
+     * Returns true if the check state of a folder is taken from the dirty set instead of its children:
+     * it is collapsed and nothing below it is selected by the user
+     */
+    bool isSummarized(const QModelIndex& index) const;
+
+    /**
+     * Returns the cheap check state of a collapsed folder, partially checked if it may contain changes
+     */
+    Qt::CheckState summaryCheckState(const QModelIndex& index) const;
+
+    /**
+     * Emits dataChanged for the top level items and the children of the expanded folders,
+     * after the check states changed everywhere
+     */
+    void refreshShown();
+
+    /**
+     * Drops the cached states of an item and the folders above it and emits dataChanged for them,
+     * used when something changed below a folder whose state is summarized
+     */
+    void refreshAncestors(const QModelIndex& index);
+
+    /**
+     * Emits dataChanged for the shown folders above an item that is not shown, so their hint is updated
+     * @param refreshed folders already updated, they are skipped and the new ones added
+     */
+    void refreshVisibleAncestors(KDevelop::ProjectBaseItem* item, QSet<KDevelop::ProjectBaseItem*>* refreshed);
+
+    /**
+     * Sets the new check state of a file or empty folder, updates the cached
+     * folders above it and emits dataChanged for every index that changed.
+     */
+    void updateCheckState(const QModelIndex& index, Qt::CheckState state);
+
     KDevelop::IProject* m_project; ///< current project
     KConfigGroup m_profileConfigGroup; ///< KConfigGroup for active upload-profile
-    QMap<QModelIndex, Qt::CheckState> m_checkStates; ///< holds the user-modified states of the checkboxes
+    UploadStateStore* m_stateStore; ///< upload times of the active upload-profile
+    UploadDirtySet* m_dirtySet; ///< modified files of the active upload-profile
+    UploadCheckOverrides m_checkStates; ///< holds the user-modified states of the checkboxes by path
+    QSet<QString> m_overriddenFolders; ///< folders with user-modified states below them
+    QStringList m_remoteOnly; ///< items only in the destination of the current profile
+    mutable QHash<KDevelop::ProjectBaseItem*, CheckNode> m_checkCache; ///< check states computed so far
     KDevelop::ProjectBaseItem* m_rootItem; ///< rootItem, tree is only displayed from here
+    QSet<uint> m_expanded; ///< folders the view shows expanded, by path
+    mutable bool m_evaluateAll; ///< if collapsed folders are evaluated too, set while evaluatedCheckState() runs
 };
 
 
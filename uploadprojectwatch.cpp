@@ -0,0 +1,61 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+#include "uploadprojectwatch.h"
+
+#include <KDirWatch>
+
+#include <interfaces/iproject.h>
+#include <util/path.h>
+
+#include "kdevuploaddebug.h"
+
+UploadProjectWatch* UploadProjectWatch::forProject(KDevelop::IProject* project)
+{
+    UploadProjectWatch* watch = project->findChild<UploadProjectWatch*>(QString(), Qt::FindDirectChildrenOnly);
+    if (!watch) {
+        watch = new UploadProjectWatch(project);
+    }
+    return watch;
+}
+
+UploadProjectWatch::UploadProjectWatch(KDevelop::IProject* project)
+    : QObject(project), m_project(project), m_dirWatch(nullptr)
+{
+}
+
+void UploadProjectWatch::addUser(QObject* user)
+{
+    if (m_users.contains(user)) return;
+    m_users.insert(user);
+    connect(user, SIGNAL(destroyed(QObject*)), this, SLOT(userDestroyed(QObject*)));
+
+    if (!m_dirWatch) {
+        qCDebug(KDEVUPLOAD) << "watching" << m_project->path();
+        m_dirWatch = new KDirWatch(this);
+        m_dirWatch->addDir(m_project->path().toLocalFile(), KDirWatch::WatchSubDirs | KDirWatch::WatchFiles);
+        connect(m_dirWatch, SIGNAL(dirty(QString)), this, SIGNAL(fileChanged(QString)));
+        connect(m_dirWatch, SIGNAL(created(QString)), this, SIGNAL(fileChanged(QString)));
+        connect(m_dirWatch, SIGNAL(deleted(QString)), this, SIGNAL(fileDeleted(QString)));
+    }
+}
+
+void UploadProjectWatch::removeUser(QObject* user)
+{
+    disconnect(user, SIGNAL(destroyed(QObject*)), this, SLOT(userDestroyed(QObject*)));
+    userDestroyed(user);
+}
+
+void UploadProjectWatch::userDestroyed(QObject* user)
+{
+    if (!m_users.remove(user) || !m_users.isEmpty()) return;
+    qCDebug(KDEVUPLOAD) << "stopped watching" << m_project->path();
+    delete m_dirWatch;
+    m_dirWatch = nullptr;
+}
+
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
@@ -0,0 +1,77 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+
+#ifndef UPLOADPROJECTWATCH_H
+#define UPLOADPROJECTWATCH_H
+
+#include <QObject>
+#include <QSet>
+
+class KDirWatch;
+namespace KDevelop {
+    class IProject;
+}
+
+/**
+ * The one recursive watch of a project directory.
+ *
+ * The dirty sets of all profiles and the continuous sync need the changes
+ * of the project files. KDirWatch shares its inotify watches between its
+ * instances already, but each recursive addDir() walks the whole tree again
+ * and registers its client on every file and directory. So they share this
+ * one watch and get its events forwarded. The directory is watched while
+ * it has users.
+ */
+class UploadProjectWatch : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Returns the watch of project, creates it on first use.
+     * The watch is a child of the project and deleted with it.
+     */
+    static UploadProjectWatch* forProject(KDevelop::IProject* project);
+
+    /**
+     * Starts watching if user is the first one. A user that is destroyed is removed.
+     */
+    void addUser(QObject* user);
+
+    /**
+     * Stops watching when the last user is removed
+     */
+    void removeUser(QObject* user);
+
+Q_SIGNALS:
+    /**
+     * Emitted when a file or directory below the project directory was written or created
+     */
+    void fileChanged(const QString& localFile);
+
+    /**
+     * Emitted when a file or directory below the project directory was deleted
+     */
+    void fileDeleted(const QString& localFile);
+
+private Q_SLOTS:
+    /**
+     * Removes user, the watch is stopped with the last one
+     */
+    void userDestroyed(QObject* user);
+
+private:
+    explicit UploadProjectWatch(KDevelop::IProject* project);
+
+    KDevelop::IProject* m_project;
+    QSet<QObject*> m_users;
+    KDirWatch* m_dirWatch; ///< nullptr while there are no users
+};
+
+#endif
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
@@ -0,0 +1,128 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+#include "uploadremotelisting.h"
+
+#include <kio/job.h>
+#include <kio/listjob.h>
+
+#include "kdevuploaddebug.h"
+#include "uploadconnectionpool.h"
+
+UploadRemoteListing::UploadRemoteListing(QObject* parent)
+    : QObject(parent), m_connectionPool(nullptr)
+{
+}
+
+UploadRemoteListing::~UploadRemoteListing()
+{
+    abort();
+}
+
+void UploadRemoteListing::setConnectionPool(UploadConnectionPool* pool)
+{
+    m_connectionPool = pool;
+}
+
+QString UploadRemoteListing::key(const QUrl& url)
+{
+    return url.adjusted(QUrl::StripTrailingSlash | QUrl::NormalizePathSegments).toString();
+}
+
+QUrl UploadRemoteListing::parentUrl(const QUrl& url)
+{
+    return url.adjusted(QUrl::StripTrailingSlash).adjusted(QUrl::RemoveFilename | QUrl::StripTrailingSlash);
+}
+
+UploadRemoteListing::Existence UploadRemoteListing::existence(const QUrl& url) const
+{
+    QHash<QString, QSet<QString> >::const_iterator it = m_listings.constFind(key(parentUrl(url)));
+    if (it == m_listings.constEnd()) return Unknown;
+    return it->contains(url.adjusted(QUrl::StripTrailingSlash).fileName()) ? Exists : Missing;
+}
+
+bool UploadRemoteListing::isListed(const QUrl& directory) const
+{
+    return m_listings.contains(key(directory));
+}
+
+void UploadRemoteListing::list(const QUrl& directory)
+{
+    QString k = key(directory);
+    if (m_listings.contains(k)) return;
+    Q_FOREACH (const QString& running, m_jobs) {
+        if (running == k) return;
+    }
+
+    qCDebug(KDEVUPLOAD) << "listDir" << directory;
+    KIO::ListJob* job = KIO::listDir(directory, KIO::HideProgressInfo);
+    if (m_connectionPool) {
+        m_connectionPool->schedule(job);
+    }
+    m_jobs.insert(job, k);
+    connect(job, SIGNAL(entries(KIO::Job*, KIO::UDSEntryList)),
+            this, SLOT(entries(KIO::Job*, KIO::UDSEntryList)));
+    connect(job, SIGNAL(result(KJob*)),
+            this, SLOT(listResult(KJob*)));
+}
+
+void UploadRemoteListing::addDirectory(const QUrl& url)
+{
+    QString parent = key(parentUrl(url));
+    QString name = url.adjusted(QUrl::StripTrailingSlash).fileName();
+    QHash<QString, QSet<QString> >::iterator it = m_listings.find(parent);
+    if (it != m_listings.end()) {
+        it->insert(name);
+    }
+    //a listing of the parent that is still running may have missed it
+    for (QHash<KJob*, QString>::const_iterator job = m_jobs.constBegin(); job != m_jobs.constEnd(); ++job) {
+        if (job.value() == parent) {
+            m_pending[job.key()].insert(name);
+        }
+    }
+    m_listings.insert(key(url), QSet<QString>());
+}
+
+void UploadRemoteListing::abort()
+{
+    QHash<KJob*, QString> jobs = m_jobs;
+    m_jobs.clear();
+    m_pending.clear();
+    Q_FOREACH (KJob* job, jobs.keys()) {
+        job->disconnect(this);
+        job->kill(KJob::Quietly);
+    }
+}
+
+void UploadRemoteListing::entries(KIO::Job* job, const KIO::UDSEntryList& list)
+{
+    if (!m_jobs.contains(job)) return;
+    QSet<QString>& names = m_pending[job];
+    Q_FOREACH (const KIO::UDSEntry& entry, list) {
+        QString name = entry.stringValue(KIO::UDSEntry::UDS_NAME);
+        if (name != "." && name != "..") {
+            names.insert(name);
+        }
+    }
+}
+
+void UploadRemoteListing::listResult(KJob* job)
+{
+    if (!m_jobs.contains(job)) return;
+    QString k = m_jobs.take(job);
+    QSet<QString> names = m_pending.take(job);
+    if (job->error()) {
+        //eg. the directory doesn't exist, then nothing in it exists either
+        qCDebug(KDEVUPLOAD) << "listDir failed" << k << job->errorString();
+        names.clear();
+    }
+    //only a complete listing may answer Missing, so it is published now and not per batch of entries
+    m_listings[k].unite(names);
+    emit listed(QUrl(k));
+}
+
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
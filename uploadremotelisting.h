@@ -0,0 +1,104 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+
+#ifndef UPLOADREMOTELISTING_H
+#define UPLOADREMOTELISTING_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QUrl>
+
+#include <kio/udsentry.h>
+
+class KJob;
+class UploadConnectionPool;
+namespace KIO {
+    class Job;
+}
+
+/**
+ * Cache of the directory listings in the destination of an upload session.
+ *
+ * Instead of a stat per directory, the parent is listed once and the
+ * existence of all its entries is answered from that listing. Directories
+ * the upload creates are added, so they don't need to be listed at all.
+ */
+class UploadRemoteListing : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Existence {
+        Unknown, ///< the parent is not listed yet, call list()
+        Exists,
+        Missing
+    };
+
+    explicit UploadRemoteListing(QObject* parent = nullptr);
+    ~UploadRemoteListing() override;
+
+    /**
+     * Sets the pool the listings are run on, nullptr to schedule them as usual
+     */
+    void setConnectionPool(UploadConnectionPool* pool);
+
+    /**
+     * Returns if url exists in the destination, as far as the listing of its parent knows.
+     * Unknown while the listing of the parent is still running.
+     */
+    Existence existence(const QUrl& url) const;
+
+    /**
+     * Returns true if the directory was listed or created by the upload
+     */
+    bool isListed(const QUrl& directory) const;
+
+    /**
+     * Starts listing a directory, listed() is emitted when it is done.
+     * Does nothing if the directory is listed already or the listing is running.
+     */
+    void list(const QUrl& directory);
+
+    /**
+     * Records a directory the upload created, it is known to be empty
+     */
+    void addDirectory(const QUrl& url);
+
+    /**
+     * Kills the running listings
+     */
+    void abort();
+
+    /**
+     * Returns the directory that contains url
+     */
+    static QUrl parentUrl(const QUrl& url);
+
+Q_SIGNALS:
+    /**
+     * Emitted when the listing of directory finished. A directory that can't be
+     * listed is treated as empty.
+     */
+    void listed(const QUrl& directory);
+
+private Q_SLOTS:
+    void entries(KIO::Job* job, const KIO::UDSEntryList& list);
+    void listResult(KJob* job);
+
+private:
+    static QString key(const QUrl& url);
+
+    QHash<QString, QSet<QString> > m_listings; ///< names in the listed directories, only complete listings
+    QHash<KJob*, QString> m_jobs; ///< running listings with their directory
+    QHash<KJob*, QSet<QString> > m_pending; ///< names received by the running listings so far
+    UploadConnectionPool* m_connectionPool;
+};
+
+#endif
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
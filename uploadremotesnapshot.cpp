@@ -0,0 +1,258 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+#include "uploadremotesnapshot.h"
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+#include <QVector>
+
+#include <kio/job.h>
+#include <kio/listjob.h>
+
+#include <interfaces/iproject.h>
+#include <util/path.h>
+
+#include "kdevuploaddebug.h"
+#include "uploadconnectionpool.h"
+#include "uploadstatestore.h"
+
+namespace {
+    const int diffBatchSize = 1024; ///< files handed to a worker at once
+    const qint64 mtimeTolerance = 2; ///< secs, some file systems and servers only keep even seconds
+    const qint64 uploadTolerance = 120; ///< secs between the end of our upload and the remote mtime, for slow transfers
+
+    /**
+     * Compares a batch of local files with the remote listing on a worker thread
+     */
+    class DiffTask : public QRunnable
+    {
+    public:
+        DiffTask(const QVector<UploadRemoteSnapshot::DiffItem>& items,
+                 const QHash<QString, UploadRemoteSnapshot::RemoteEntry>& remote,
+                 bool preservedTimes, qint64 clockSkew, UploadRemoteSnapshot* snapshot)
+            : m_items(items), m_remote(remote), m_preservedTimes(preservedTimes), m_clockSkew(clockSkew),
+              m_snapshot(snapshot) {}
+
+        void run() override
+        {
+            QStringList differences;
+            QStringList gone;
+            Q_FOREACH (const UploadRemoteSnapshot::DiffItem& item, m_items) {
+                if (item.remoteOnly) {
+                    if (!QFileInfo::exists(item.localFile)) {
+                        gone << item.relativeUrl;
+                    }
+                    continue;
+                }
+                QHash<QString, UploadRemoteSnapshot::RemoteEntry>::const_iterator it = m_remote.constFind(item.relativeUrl);
+                if (UploadRemoteSnapshot::differs(item, it == m_remote.constEnd() ? nullptr : &it.value(),
+                                                  m_preservedTimes, m_clockSkew)) {
+                    differences << item.path;
+                }
+            }
+            m_snapshot->addDifferences(differences, gone);
+        }
+
+    private:
+        QVector<UploadRemoteSnapshot::DiffItem> m_items;
+        const QHash<QString, UploadRemoteSnapshot::RemoteEntry> m_remote; ///< shared with the other tasks, read only
+        bool m_preservedTimes;
+        qint64 m_clockSkew;
+        UploadRemoteSnapshot* m_snapshot; ///< waits for the workers before it is deleted
+    };
+}
+
+UploadRemoteSnapshot::UploadRemoteSnapshot(KDevelop::IProject* project, const KConfigGroup& profile, QObject* parent)
+    : QObject(parent), m_project(project), m_profile(profile), m_connectionPool(nullptr), m_job(nullptr),
+      m_pendingBatches(0)
+{
+    m_workers.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+UploadRemoteSnapshot::~UploadRemoteSnapshot()
+{
+    if (m_job) {
+        m_job->disconnect(this);
+        m_job->kill(KJob::Quietly);
+    }
+    //the workers call addDifferences()
+    m_workers.clear();
+    m_workers.waitForDone();
+}
+
+void UploadRemoteSnapshot::setConnectionPool(UploadConnectionPool* pool)
+{
+    m_connectionPool = pool;
+}
+
+void UploadRemoteSnapshot::start()
+{
+    QUrl dest = m_profile.readEntry("url", QUrl()).adjusted(QUrl::StripTrailingSlash);
+    qCDebug(KDEVUPLOAD) << "listRecursive" << dest;
+    KIO::ListJob* job = KIO::listRecursive(dest, KIO::HideProgressInfo);
+    if (m_connectionPool) {
+        m_connectionPool->schedule(job);
+    }
+    m_job = job;
+    connect(job, SIGNAL(entries(KIO::Job*, KIO::UDSEntryList)),
+            this, SLOT(entries(KIO::Job*, KIO::UDSEntryList)));
+    connect(job, SIGNAL(result(KJob*)),
+            this, SLOT(listResult(KJob*)));
+}
+
+void UploadRemoteSnapshot::entries(KIO::Job* job, const KIO::UDSEntryList& list)
+{
+    Q_UNUSED(job);
+    Q_FOREACH (const KIO::UDSEntry& entry, list) {
+        //names are relative to the listed directory, "dir/file" for the subdirectories
+        QString name = entry.stringValue(KIO::UDSEntry::UDS_NAME);
+        if (entry.isDir()) {
+            QString fileName = name.mid(name.lastIndexOf('/') + 1);
+            if (fileName != "." && fileName != "..") {
+                m_remoteDirectories.insert(name);
+            }
+            continue;
+        }
+        RemoteEntry remote;
+        remote.size = entry.numberValue(KIO::UDSEntry::UDS_SIZE, 0);
+        remote.modified = entry.numberValue(KIO::UDSEntry::UDS_MODIFICATION_TIME, -1);
+        m_remote.insert(name, remote);
+    }
+}
+
+void UploadRemoteSnapshot::listResult(KJob* job)
+{
+    m_job = nullptr;
+    if (job->error() == KIO::ERR_DOES_NOT_EXIST) {
+        //nothing was uploaded yet, everything differs
+        m_remote.clear();
+        m_remoteDirectories.clear();
+    } else if (job->error()) {
+        qCDebug(KDEVUPLOAD) << "listRecursive failed" << job->errorString();
+        m_errorString = job->errorString();
+        emit finished(false);
+        return;
+    }
+    qCDebug(KDEVUPLOAD) << "listed" << m_remote.count() << "remote files";
+    startDiff();
+}
+
+void UploadRemoteSnapshot::startDiff()
+{
+    KDevelop::Path localPath(m_profile.readEntry("localUrl", QUrl()).adjusted(QUrl::StripTrailingSlash).path());
+    if (localPath.path().isEmpty()) {
+        localPath = m_project->path();
+    }
+    UploadStateStore* stateStore = UploadStateStore::forProfile(m_project, m_profile);
+
+    //the lookups in the state store stay on this thread, the workers only stat the files
+    QVector<QVector<DiffItem> > batches;
+    QVector<DiffItem> items;
+    QSet<QString> local;
+    Q_FOREACH (const KDevelop::IndexedString& file, m_project->fileSet()) {
+        KDevelop::Path path(file.str());
+        if (!localPath.isParentOf(path)) continue;
+        DiffItem item;
+        item.path = m_project->path().relativePath(path);
+        item.relativeUrl = localPath.relativePath(path);
+        item.localFile = file.str();
+        QDateTime uploadTime = stateStore->uploadTime(item.path);
+        item.uploadTime = uploadTime.isValid() ? uploadTime.toMSecsSinceEpoch() / 1000 : -1;
+        item.remoteOnly = false;
+        m_compared.insert(item.path);
+        local.insert(item.relativeUrl);
+        items << item;
+        if (items.count() == diffBatchSize) {
+            batches << items;
+            items.clear();
+        }
+    }
+
+    //the rest of the destination, the workers check if it exists locally outside of the project files
+    QSet<QString> remoteOnly = m_remoteDirectories;
+    for (QHash<QString, RemoteEntry>::const_iterator it = m_remote.constBegin(); it != m_remote.constEnd(); ++it) {
+        if (!local.contains(it.key())) {
+            remoteOnly.insert(it.key());
+        }
+    }
+    Q_FOREACH (const QString& relativeUrl, remoteOnly) {
+        DiffItem item;
+        item.relativeUrl = relativeUrl;
+        item.localFile = KDevelop::Path(localPath, relativeUrl).toLocalFile();
+        item.uploadTime = -1;
+        item.remoteOnly = true;
+        items << item;
+        if (items.count() == diffBatchSize) {
+            batches << items;
+            items.clear();
+        }
+    }
+    if (!items.isEmpty()) {
+        batches << items;
+    }
+
+    if (batches.isEmpty()) {
+        emit finished(true);
+        return;
+    }
+    //uploads with preserved attributes give the remote files the local mtime, that doesn't depend on the server clock
+    bool preservedTimes = m_profile.readEntry("preserveAttributes", false);
+    qint64 clockSkew = m_profile.readEntry("clockSkew", Q_INT64_C(0));
+    m_pendingBatches = batches.count();
+    Q_FOREACH (const QVector<DiffItem>& batch, batches) {
+        m_workers.start(new DiffTask(batch, m_remote, preservedTimes, clockSkew, this));
+    }
+}
+
+bool UploadRemoteSnapshot::differs(const DiffItem& item, const RemoteEntry* remote, bool preservedTimes, qint64 clockSkew)
+{
+    if (!remote) return true;
+    QFileInfo info(item.localFile);
+    if (!info.isFile()) return false; //deleted locally, nothing to upload
+    if (static_cast<KIO::filesize_t>(info.size()) != remote->size) return true;
+    if (remote->modified == -1) return false; //the protocol has no times, the size has to do
+
+    qint64 localModified = info.lastModified().toMSecsSinceEpoch() / 1000;
+    if (preservedTimes) {
+        //our uploads carry the local mtime, anything else was written by somebody else
+        return qAbs(remote->modified - localModified) > mtimeTolerance;
+    }
+
+    //the server stamps its own time, bring it to our clock first
+    qint64 remoteModified = remote->modified - clockSkew;
+    qint64 delta = remoteModified - localModified;
+    if (qAbs(delta) <= mtimeTolerance) return false;
+    if (delta < 0) return true; //changed locally after the remote copy was written
+
+    //the remote copy is newer, that's fine if it was written by our last upload
+    return item.uploadTime == -1 || qAbs(remoteModified - item.uploadTime) > uploadTolerance;
+}
+
+void UploadRemoteSnapshot::addDifferences(const QStringList& paths, const QStringList& gone)
+{
+    QMutexLocker lock(&m_differencesMutex);
+    Q_FOREACH (const QString& path, paths) {
+        m_differences.insert(path);
+    }
+    m_remoteOnly += gone;
+    if (--m_pendingBatches == 0) {
+        QMetaObject::invokeMethod(this, "diffDone", Qt::QueuedConnection);
+    }
+}
+
+void UploadRemoteSnapshot::diffDone()
+{
+    qCDebug(KDEVUPLOAD) << m_differences.count() << "of" << m_compared.count() << "files differ from the destination,"
+                        << m_remoteOnly.count() << "remote items don't exist locally";
+    emit finished(true);
+}
+
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
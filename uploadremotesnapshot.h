@@ -0,0 +1,175 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+
+#ifndef UPLOADREMOTESNAPSHOT_H
+#define UPLOADREMOTESNAPSHOT_H
+
+#include <QObject>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QStringList>
+#include <QThreadPool>
+#include <QUrl>
+
+#include <kconfiggroup.h>
+#include <kio/global.h>
+#include <kio/udsentry.h>
+
+class KJob;
+namespace KIO {
+    class Job;
+}
+namespace KDevelop {
+    class IProject;
+}
+class UploadConnectionPool;
+
+/**
+ * Compares the local files of an upload-profile with what is in its destination.
+ *
+ * The destination is listed with one recursive listing, which gives the size
+ * and modification time of every remote file without a request per file. The
+ * listing is kept in memory and diffed against the local files on a pool of
+ * worker threads. A file differs if it is missing remotely, has another size,
+ * or the remote copy was written by somebody else. With preserved attributes
+ * that is a remote mtime other than the local one; else it is older than the
+ * local file, or newer than the last upload from here, after correcting the
+ * remote times by the clock skew of the server. Items of the destination that
+ * don't exist locally are collected for mirroring deletions.
+ *
+ * Paths are relative to the project directory, like in UploadStateStore.
+ */
+class UploadRemoteSnapshot : public QObject
+{
+    Q_OBJECT
+
+public:
+    UploadRemoteSnapshot(KDevelop::IProject* project, const KConfigGroup& profile, QObject* parent = nullptr);
+    ~UploadRemoteSnapshot() override;
+
+    /**
+     * Sets the pool the listing is run on, nullptr to schedule it as usual
+     */
+    void setConnectionPool(UploadConnectionPool* pool);
+
+    /**
+     * Starts listing the destination, finished() is emitted when the diff is done
+     */
+    void start();
+
+    /**
+     * Returns the local files that differ from the destination, valid after finished()
+     */
+    QSet<QString> differences() const {
+        return m_differences;
+    }
+
+    /**
+     * Returns the local files that were compared, the files of the project below the profile's local url
+     */
+    QSet<QString> compared() const {
+        return m_compared;
+    }
+
+    /**
+     * Returns the files and directories in the destination that don't exist locally,
+     * relative to the destination, valid after finished()
+     */
+    QStringList remoteOnly() const {
+        return m_remoteOnly;
+    }
+
+    /**
+     * Returns the number of files in the destination
+     */
+    int remoteCount() const {
+        return m_remote.count();
+    }
+
+    /**
+     * Returns the error message if the destination couldn't be listed
+     */
+    QString errorString() const {
+        return m_errorString;
+    }
+
+    /**
+     * Size and modification time of a remote file
+     */
+    struct RemoteEntry {
+        KIO::filesize_t size;
+        qint64 modified; ///< seconds since the epoch
+    };
+
+    /**
+     * A local file to compare, with its upload time looked up on the GUI thread
+     */
+    struct DiffItem {
+        QString path;
+        QString relativeUrl; ///< path below the profile's local url, the key of the remote entry
+        QString localFile;
+        qint64 uploadTime; ///< seconds since the epoch, -1 if it was never uploaded
+        bool remoteOnly; ///< an item of the destination that isn't a project file, only checked for existence
+    };
+
+    /**
+     * Called by the workers with the results of a batch
+     * @param paths files that differ
+     * @param gone items of the destination that don't exist locally
+     */
+    void addDifferences(const QStringList& paths, const QStringList& gone);
+
+    /**
+     * Returns true if a local file differs from the remote entry
+     * @param remote entry of the file, nullptr if it is missing remotely
+     * @param preservedTimes if the uploads of the profile set the remote mtime to the local one
+     * @param clockSkew secs the server clock is ahead of ours, as measured by the last UploadJob
+     */
+    static bool differs(const DiffItem& item, const RemoteEntry* remote, bool preservedTimes, qint64 clockSkew);
+
+Q_SIGNALS:
+    /**
+     * Emitted when the comparison is done
+     * @param success false if the destination couldn't be listed, see errorString()
+     */
+    void finished(bool success);
+
+private Q_SLOTS:
+    void entries(KIO::Job* job, const KIO::UDSEntryList& list);
+    void listResult(KJob* job);
+
+    /**
+     * Called on the GUI thread when the last batch is diffed
+     */
+    void diffDone();
+
+private:
+    /**
+     * Hands the local files to the workers
+     */
+    void startDiff();
+
+    KDevelop::IProject* m_project;
+    KConfigGroup m_profile;
+    UploadConnectionPool* m_connectionPool;
+    KJob* m_job; ///< the running listing
+    QHash<QString, RemoteEntry> m_remote; ///< remote files by path below the destination
+    QSet<QString> m_remoteDirectories; ///< remote directories by path below the destination
+    QSet<QString> m_compared;
+    QString m_errorString;
+
+    QThreadPool m_workers; ///< stat the local files, waited for when the snapshot is deleted
+    QMutex m_differencesMutex;
+    QSet<QString> m_differences;
+    QStringList m_remoteOnly;
+    int m_pendingBatches; ///< batches the workers didn't finish yet, guarded by m_differencesMutex
+};
+
+#endif
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
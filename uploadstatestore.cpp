@@ -0,0 +1,663 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+#include "uploadstatestore.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QDataStream>
+#include <QMap>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QtEndian>
+#include <cstring>
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#endif
+#include "kdevuploaddebug.h"
+
+#include <interfaces/iproject.h>
+#include <util/path.h>
+
+/*
+ * State file layout, all numbers little endian:
+ *
+ *   header:  "KDUS" | quint32 version | quint32 record count | quint32 reserved
+ *   records: sorted by the UTF-8 bytes of the path, recordSize bytes each
+ *            quint32 path offset | quint32 path length | qint64 upload time (msecs, 0 = none)
+ *            qint64 size (-1 = no fingerprint) | qint64 mtime | quint64 inode | 16 bytes hash
+ *   paths:   UTF-8, offsets are relative to the start of this block
+ *
+ * Journal records, appended in groups:
+ *
+ *   quint32 payload length | quint16 qChecksum of the payload | payload (QDataStream)
+ *   payload: quint8 operation | QString path | qint64 upload time | qint64 size
+ *            | qint64 mtime | quint64 inode | QByteArray hash
+ *
+ * A record that was not completely written when the process died fails the
+ * length or checksum test; it and everything after it are ignored.
+ */
+namespace {
+    const char magic[4] = { 'K', 'D', 'U', 'S' };
+    const quint32 version = 1;
+    const int headerSize = 16;
+    const int recordSize = 56;
+    const int hashSize = 16;
+
+    const int journalGroupSize = 64; ///< commit the journal after this many changes
+    const int journalCommitDelay = 250; ///< or this many msecs after the first pending change
+    const qint64 journalCompactSize = 4 * 1024 * 1024; ///< fold the journal into the state file when it gets bigger
+
+    /**
+     * Settings of a profile that live next to the old per-file entries and must not be migrated
+     */
+    /**
+     * Finds the entries of collectGarbage() whose files are gone, on a worker thread
+     */
+    class GarbageTask : public QRunnable
+    {
+    public:
+        GarbageTask(const QString& base, const QStringList& paths, UploadStateStore* store)
+            : m_base(base), m_paths(paths), m_store(store) {}
+
+        void run() override
+        {
+            QStringList missing;
+            Q_FOREACH (const QString& path, m_paths) {
+                if (!QFile::exists(m_base + '/' + path)) {
+                    missing << path;
+                }
+            }
+            QMetaObject::invokeMethod(m_store, "removeGarbage", Qt::QueuedConnection,
+                                      Q_ARG(QString, m_base), Q_ARG(QStringList, missing));
+        }
+
+    private:
+        QString m_base;
+        QStringList m_paths;
+        UploadStateStore* m_store; ///< waits for the worker before it is deleted
+    };
+
+    const char* const profileSettings[] = {
+        "name", "url", "localUrl", "concurrency", "concurrencyLimit", "concurrencyCeiling", "connections", "rememberSelection",
+        "continuousSync", "preserveAttributes", "mirrorDeletions", "clockSkew"
+    };
+}
+
+UploadStateStore* UploadStateStore::forProfile(KDevelop::IProject* project, const KConfigGroup& profile)
+{
+    UploadStateStore* store = project->findChild<UploadStateStore*>(profile.name(), Qt::FindDirectChildrenOnly);
+    if (!store) {
+        store = new UploadStateStore(fileName(project, profile.name()), profile, project);
+        store->setObjectName(profile.name());
+    }
+    return store;
+}
+
+void UploadStateStore::discard(KDevelop::IProject* project, const QString& profileGroup)
+{
+    delete project->findChild<UploadStateStore*>(profileGroup, Qt::FindDirectChildrenOnly);
+    QString name = fileName(project, profileGroup);
+    QFile::remove(name);
+    QFile::remove(name + ".journal");
+    QFile::remove(name + ".selection");
+}
+
+QString UploadStateStore::fileName(KDevelop::IProject* project, const QString& profileGroup)
+{
+    KDevelop::Path dir = project->developerFile().parent();
+    return KDevelop::Path(dir, "upload-" + profileGroup + ".state").toLocalFile();
+}
+
+UploadStateStore::UploadStateStore(const QString& fileName, const KConfigGroup& profile, QObject* parent)
+    : QObject(parent), m_file(fileName), m_profile(profile), m_loaded(false), m_data(nullptr), m_count(0),
+      m_journal(fileName + ".journal"), m_pendingCount(0), m_collecting(false)
+{
+    m_workers.setMaxThreadCount(1);
+    m_commitTimer.setSingleShot(true);
+    m_commitTimer.setInterval(journalCommitDelay);
+    connect(&m_commitTimer, SIGNAL(timeout()), this, SLOT(sync()));
+}
+
+UploadStateStore::~UploadStateStore()
+{
+    //the garbage is collected the next time
+    m_workers.clear();
+    m_workers.waitForDone();
+    if (m_loaded && !compact()) {
+        //keep what we have in the journal at least
+        sync();
+    }
+    unmap();
+}
+
+void UploadStateStore::load()
+{
+    if (m_loaded) return;
+    m_loaded = true;
+
+    if (!m_file.exists()) {
+        migrate();
+        compact();
+    } else {
+        map();
+    }
+
+    if (replayJournal()) {
+        compact();
+    }
+}
+
+void UploadStateStore::map()
+{
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qCWarning(KDEVUPLOAD) << "can't open upload state" << m_file.fileName();
+        return;
+    }
+    qint64 size = m_file.size();
+    const uchar* data = size >= headerSize ? m_file.map(0, size) : nullptr;
+    if (!data || memcmp(data, magic, sizeof(magic)) != 0
+        || qFromLittleEndian<quint32>(data + 4) != version) {
+        qCWarning(KDEVUPLOAD) << "invalid upload state" << m_file.fileName();
+        m_file.close();
+        return;
+    }
+    quint32 count = qFromLittleEndian<quint32>(data + 8);
+    if (headerSize + static_cast<qint64>(count) * recordSize > size) {
+        qCWarning(KDEVUPLOAD) << "truncated upload state" << m_file.fileName();
+        m_file.close();
+        return;
+    }
+    m_data = data;
+    m_count = count;
+}
+
+void UploadStateStore::unmap()
+{
+    if (m_data) {
+        m_file.unmap(const_cast<uchar*>(m_data));
+        m_data = nullptr;
+    }
+    m_count = 0;
+    m_file.close();
+}
+
+void UploadStateStore::migrate()
+{
+    if (!m_profile.isValid()) return;
+
+    QStringList settings;
+    for (const char* key : profileSettings) {
+        settings << QString::fromLatin1(key);
+    }
+
+    int migrated = 0;
+    Q_FOREACH (const QString& key, m_profile.keyList()) {
+        if (settings.contains(key)) continue;
+        QDateTime time = m_profile.readEntry(key, QDateTime());
+        if (time.isValid()) {
+            Entry& e = m_changes[key];
+            e.uploadTime = time;
+            m_profile.deleteEntry(key);
+            ++migrated;
+        }
+    }
+    KConfigGroup fingerprints = m_profile.group("Fingerprints");
+    Q_FOREACH (const QString& key, fingerprints.keyList()) {
+        UploadFingerprint fingerprint = UploadFingerprint::fromString(fingerprints.readEntry(key, QString()));
+        if (fingerprint.isValid()) {
+            m_changes[key].fingerprint = fingerprint;
+        }
+    }
+    fingerprints.deleteGroup();
+
+    if (migrated) {
+        qCDebug(KDEVUPLOAD) << "migrated" << migrated << "upload times of" << m_profile.name();
+        m_profile.sync();
+    }
+}
+
+int UploadStateStore::findRecord(const QByteArray& path) const
+{
+    const uchar* paths = m_data + headerSize + m_count * recordSize;
+    int low = 0;
+    int high = static_cast<int>(m_count) - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        const uchar* record = m_data + headerSize + mid * recordSize;
+        quint32 offset = qFromLittleEndian<quint32>(record);
+        quint32 length = qFromLittleEndian<quint32>(record + 4);
+        int cmp = memcmp(paths + offset, path.constData(), qMin<quint32>(length, path.size()));
+        if (cmp == 0) {
+            cmp = static_cast<int>(length) - path.size();
+        }
+        if (cmp == 0) {
+            return mid;
+        } else if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return -1;
+}
+
+QByteArray UploadStateStore::recordPath(int record) const
+{
+    const uchar* r = m_data + headerSize + record * recordSize;
+    const uchar* paths = m_data + headerSize + m_count * recordSize;
+    return QByteArray(reinterpret_cast<const char*>(paths + qFromLittleEndian<quint32>(r)),
+                      qFromLittleEndian<quint32>(r + 4));
+}
+
+UploadStateStore::Entry UploadStateStore::recordEntry(int record) const
+{
+    const uchar* r = m_data + headerSize + record * recordSize;
+    Entry ret;
+    qint64 time = qFromLittleEndian<qint64>(r + 8);
+    if (time) {
+        ret.uploadTime = QDateTime::fromMSecsSinceEpoch(time);
+    }
+    qint64 size = qFromLittleEndian<qint64>(r + 16);
+    if (size >= 0) {
+        QByteArray hash(reinterpret_cast<const char*>(r + 40), hashSize);
+        if (hash == QByteArray(hashSize, '\0')) {
+            hash.clear();
+        }
+        ret.fingerprint = UploadFingerprint(size, qFromLittleEndian<qint64>(r + 24),
+                                            qFromLittleEndian<quint64>(r + 32), hash);
+    }
+    return ret;
+}
+
+bool UploadStateStore::lookup(const QString& path, Entry* entry)
+{
+    load();
+    if (m_removed.contains(path)) return false;
+    QHash<QString, Entry>::const_iterator it = m_changes.constFind(path);
+    if (it != m_changes.constEnd()) {
+        *entry = it.value();
+        return true;
+    }
+    if (!m_data) return false;
+    int record = findRecord(path.toUtf8());
+    if (record == -1) return false;
+    *entry = recordEntry(record);
+    return true;
+}
+
+bool UploadStateStore::contains(const QString& path)
+{
+    Entry e;
+    return lookup(path, &e);
+}
+
+QDateTime UploadStateStore::uploadTime(const QString& path)
+{
+    Entry e;
+    lookup(path, &e);
+    return e.uploadTime;
+}
+
+UploadFingerprint UploadStateStore::fingerprint(const QString& path)
+{
+    Entry e;
+    lookup(path, &e);
+    return e.fingerprint;
+}
+
+void UploadStateStore::change(const QString& path, const Entry& entry)
+{
+    m_removed.remove(path);
+    m_changes.insert(path, entry);
+    appendJournal(SetEntry, path, entry);
+    emit entriesChanged(QStringList() << path);
+}
+
+void UploadStateStore::setUploaded(const QString& path, const QDateTime& time)
+{
+    Entry e;
+    lookup(path, &e);
+    e.uploadTime = time;
+    change(path, e);
+}
+
+void UploadStateStore::setFingerprint(const QString& path, const UploadFingerprint& fingerprint)
+{
+    Entry e;
+    lookup(path, &e);
+    e.fingerprint = fingerprint;
+    change(path, e);
+}
+
+void UploadStateStore::remove(const QString& path)
+{
+    load();
+    m_changes.remove(path);
+    m_removed.insert(path);
+    appendJournal(RemoveEntry, path);
+    emit entriesChanged(QStringList() << path);
+}
+
+void UploadStateStore::move(const QString& from, const QString& to)
+{
+    Entry e;
+    if (!lookup(from, &e)) return;
+    change(to, e);
+    remove(from);
+}
+
+void UploadStateStore::setUploaded(const QStringList& paths, const QDateTime& time)
+{
+    m_commitTimer.stop();
+    Q_FOREACH (const QString& path, paths) {
+        Entry e;
+        lookup(path, &e);
+        e.uploadTime = time;
+        m_removed.remove(path);
+        m_changes.insert(path, e);
+        m_pendingRecords += journalRecord(SetEntry, path, e);
+    }
+    m_pendingCount += paths.count();
+    sync();
+    emit entriesChanged(paths);
+}
+
+void UploadStateStore::setFingerprints(const QStringList& paths, const QList<UploadFingerprint>& fingerprints)
+{
+    m_commitTimer.stop();
+    for (int i = 0; i < paths.count(); ++i) {
+        Entry e;
+        lookup(paths.at(i), &e);
+        e.fingerprint = fingerprints.at(i);
+        m_removed.remove(paths.at(i));
+        m_changes.insert(paths.at(i), e);
+        m_pendingRecords += journalRecord(SetEntry, paths.at(i), e);
+    }
+    m_pendingCount += paths.count();
+    sync();
+    emit entriesChanged(paths);
+}
+
+QByteArray UploadStateStore::journalRecord(JournalOperation operation, const QString& path, const Entry& entry)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream << static_cast<quint8>(operation) << path
+           << (entry.uploadTime.isValid() ? entry.uploadTime.toMSecsSinceEpoch() : qint64(0))
+           << entry.fingerprint.size() << entry.fingerprint.modificationTime()
+           << entry.fingerprint.inode() << entry.fingerprint.hash();
+
+    QByteArray record(6, '\0');
+    qToLittleEndian<quint32>(payload.size(), reinterpret_cast<uchar*>(record.data()));
+    qToLittleEndian<quint16>(qChecksum(payload.constData(), payload.size()), reinterpret_cast<uchar*>(record.data()) + 4);
+    return record + payload;
+}
+
+void UploadStateStore::appendJournal(JournalOperation operation, const QString& path, const Entry& entry)
+{
+    m_pendingRecords += journalRecord(operation, path, entry);
+    if (++m_pendingCount >= journalGroupSize) {
+        sync();
+    } else if (!m_commitTimer.isActive()) {
+        m_commitTimer.start();
+    }
+}
+
+bool UploadStateStore::sync()
+{
+    m_commitTimer.stop();
+    if (m_pendingRecords.isEmpty()) return true;
+
+    if (!m_journal.isOpen() && !m_journal.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qCWarning(KDEVUPLOAD) << "can't open upload journal" << m_journal.fileName() << m_journal.errorString();
+        return false;
+    }
+    if (m_journal.write(m_pendingRecords) != m_pendingRecords.size() || !m_journal.flush()) {
+        qCWarning(KDEVUPLOAD) << "can't write upload journal" << m_journal.fileName() << m_journal.errorString();
+        return false;
+    }
+#ifdef Q_OS_UNIX
+    ::fsync(m_journal.handle());
+#endif
+    m_pendingRecords.clear();
+    m_pendingCount = 0;
+
+    if (m_journal.size() > journalCompactSize) {
+        compact();
+    }
+    return true;
+}
+
+int UploadStateStore::replayJournal()
+{
+    QFile journal(m_journal.fileName());
+    if (!journal.open(QIODevice::ReadOnly)) return 0;
+    QByteArray data = journal.readAll();
+
+    int replayed = 0;
+    int pos = 0;
+    while (pos + 6 <= data.size()) {
+        const uchar* header = reinterpret_cast<const uchar*>(data.constData()) + pos;
+        quint32 length = qFromLittleEndian<quint32>(header);
+        quint16 checksum = qFromLittleEndian<quint16>(header + 4);
+        if (pos + 6 + static_cast<qint64>(length) > data.size()) break;
+        QByteArray payload = data.mid(pos + 6, length);
+        if (qChecksum(payload.constData(), payload.size()) != checksum) break;
+        pos += 6 + length;
+
+        QDataStream stream(payload);
+        quint8 operation;
+        QString path;
+        qint64 time, size, mtime;
+        quint64 inode;
+        QByteArray hash;
+        stream >> operation >> path >> time >> size >> mtime >> inode >> hash;
+        if (operation == RemoveEntry) {
+            m_changes.remove(path);
+            m_removed.insert(path);
+        } else {
+            Entry e;
+            if (time) {
+                e.uploadTime = QDateTime::fromMSecsSinceEpoch(time);
+            }
+            if (size >= 0) {
+                e.fingerprint = UploadFingerprint(size, mtime, inode, hash);
+            }
+            m_removed.remove(path);
+            m_changes.insert(path, e);
+        }
+        ++replayed;
+    }
+    if (pos < data.size()) {
+        qCWarning(KDEVUPLOAD) << "ignored" << data.size() - pos << "bytes of an incomplete upload journal record";
+    }
+    if (replayed) {
+        qCDebug(KDEVUPLOAD) << "replayed" << replayed << "upload journal records of" << objectName();
+    }
+    return replayed;
+}
+
+bool UploadStateStore::isModified(const QString& path, const QString& localFile)
+{
+    UploadFingerprint recorded = fingerprint(path);
+    UploadFingerprint touched;
+    bool modified = isModified(recorded, recorded.isValid() ? QDateTime() : uploadTime(path), localFile, &touched);
+    if (touched.isValid()) {
+        //remember the new stat so we don't hash again
+        setFingerprint(path, touched);
+    }
+    return modified;
+}
+
+bool UploadStateStore::isModified(const UploadFingerprint& recorded, const QDateTime& uploadTime,
+                                  const QString& localFile, UploadFingerprint* touched)
+{
+    *touched = UploadFingerprint();
+    if (recorded.isValid()) {
+        UploadFingerprint current;
+        bool modified = recorded.isModified(localFile, &current);
+        if (!modified && current.isValid() && !recorded.sameStat(current)) {
+            //touched but same content
+            current.setHash(recorded.hash());
+            *touched = current;
+        }
+        return modified;
+    }
+    //uploaded before fingerprints were recorded, compare times
+    if (!uploadTime.isValid()) return true;
+    return QFileInfo(localFile).lastModified() > uploadTime;
+}
+
+QHash<QString, Qt::CheckState> UploadStateStore::selection() const
+{
+    QHash<QString, Qt::CheckState> ret;
+    QFile file(m_file.fileName() + ".selection");
+    if (file.open(QIODevice::ReadOnly)) {
+        QDataStream stream(&file);
+        QHash<QString, int> states;
+        stream >> states;
+        for (QHash<QString, int>::const_iterator it = states.constBegin(); it != states.constEnd(); ++it) {
+            ret.insert(it.key(), static_cast<Qt::CheckState>(it.value()));
+        }
+    }
+    return ret;
+}
+
+void UploadStateStore::setSelection(const QHash<QString, Qt::CheckState>& selection)
+{
+    QString name = m_file.fileName() + ".selection";
+    if (selection.isEmpty()) {
+        QFile::remove(name);
+        return;
+    }
+    QHash<QString, int> states;
+    for (QHash<QString, Qt::CheckState>::const_iterator it = selection.constBegin(); it != selection.constEnd(); ++it) {
+        states.insert(it.key(), it.value());
+    }
+    QDir().mkpath(QFileInfo(name).path());
+    QSaveFile file(name);
+    if (file.open(QIODevice::WriteOnly)) {
+        QDataStream stream(&file);
+        stream << states;
+        file.commit();
+    }
+}
+
+QStringList UploadStateStore::paths()
+{
+    load();
+    QStringList ret;
+    for (quint32 i = 0; i < m_count; ++i) {
+        QString path = QString::fromUtf8(recordPath(i));
+        if (!m_removed.contains(path) && !m_changes.contains(path)) {
+            ret << path;
+        }
+    }
+    ret << m_changes.keys();
+    return ret;
+}
+
+void UploadStateStore::remove(const QStringList& paths)
+{
+    load();
+    m_commitTimer.stop();
+    Q_FOREACH (const QString& path, paths) {
+        m_changes.remove(path);
+        m_removed.insert(path);
+        m_pendingRecords += journalRecord(RemoveEntry, path, Entry());
+    }
+    m_pendingCount += paths.count();
+    sync();
+    emit entriesChanged(paths);
+}
+
+void UploadStateStore::collectGarbage(const KDevelop::Path& base)
+{
+    if (m_collecting) return;
+    m_collecting = true;
+    m_workers.start(new GarbageTask(base.toLocalFile(), paths(), this));
+}
+
+void UploadStateStore::removeGarbage(const QString& base, const QStringList& missing)
+{
+    m_collecting = false;
+    QStringList removed;
+    Q_FOREACH (const QString& path, missing) {
+        //may have been uploaded again while the worker ran
+        if (contains(path) && !QFile::exists(base + '/' + path)) {
+            removed << path;
+        }
+    }
+    if (!removed.isEmpty()) {
+        qCDebug(KDEVUPLOAD) << "removing" << removed.count() << "stale upload state entries of" << objectName();
+        remove(removed);
+    }
+}
+
+bool UploadStateStore::compact()
+{
+    if (!m_loaded || (m_changes.isEmpty() && m_removed.isEmpty() && m_file.exists())) {
+        return true;
+    }
+
+    QMap<QByteArray, Entry> entries;
+    for (quint32 i = 0; i < m_count; ++i) {
+        QByteArray path = recordPath(i);
+        QString p = QString::fromUtf8(path);
+        if (!m_removed.contains(p) && !m_changes.contains(p)) {
+            entries.insert(path, recordEntry(i));
+        }
+    }
+    for (QHash<QString, Entry>::const_iterator it = m_changes.constBegin(); it != m_changes.constEnd(); ++it) {
+        entries.insert(it.key().toUtf8(), it.value());
+    }
+
+    QByteArray records(headerSize + entries.count() * recordSize, '\0');
+    QByteArray paths;
+    uchar* out = reinterpret_cast<uchar*>(records.data());
+    memcpy(out, magic, sizeof(magic));
+    qToLittleEndian<quint32>(version, out + 4);
+    qToLittleEndian<quint32>(entries.count(), out + 8);
+    out += headerSize;
+    for (QMap<QByteArray, Entry>::const_iterator it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        const Entry& e = it.value();
+        qToLittleEndian<quint32>(paths.size(), out);
+        qToLittleEndian<quint32>(it.key().size(), out + 4);
+        qToLittleEndian<qint64>(e.uploadTime.isValid() ? e.uploadTime.toMSecsSinceEpoch() : 0, out + 8);
+        qToLittleEndian<qint64>(e.fingerprint.size(), out + 16);
+        qToLittleEndian<qint64>(e.fingerprint.modificationTime(), out + 24);
+        qToLittleEndian<quint64>(e.fingerprint.inode(), out + 32);
+        QByteArray hash = e.fingerprint.hash().left(hashSize);
+        memcpy(out + 40, hash.constData(), hash.size());
+        paths += it.key();
+        out += recordSize;
+    }
+
+    //the old file can't be replaced while it is mapped everywhere
+    unmap();
+    QDir().mkpath(QFileInfo(m_file.fileName()).path());
+    QSaveFile file(m_file.fileName());
+    bool written = file.open(QIODevice::WriteOnly) && file.write(records) == records.size()
+                   && file.write(paths) == paths.size() && file.commit();
+    if (written) {
+        //everything in the journal is in the state file now
+        m_changes.clear();
+        m_removed.clear();
+        m_commitTimer.stop();
+        m_pendingRecords.clear();
+        m_pendingCount = 0;
+        m_journal.close();
+        QFile::remove(m_journal.fileName());
+    } else {
+        qCWarning(KDEVUPLOAD) << "can't write upload state" << m_file.fileName() << file.errorString();
+    }
+    map();
+    return written;
+}
+
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on
@@ -0,0 +1,234 @@
+/***************************************************************************
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+***************************************************************************/
+
+#ifndef UPLOADSTATESTORE_H
+#define UPLOADSTATESTORE_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QFile>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <kconfiggroup.h>
+
+#include "uploadfingerprint.h"
+
+namespace KDevelop {
+    class IProject;
+    class Path;
+}
+
+/**
+ * Upload times and fingerprints of the files of one upload-profile.
+ *
+ * The state lives in its own binary file next to the project's developer
+ * file instead of in the project configuration. The file holds a table of
+ * fixed-size records sorted by path followed by the paths; it is memory-mapped
+ * on first use and looked up with a binary search.
+ *
+ * Changes are appended to a journal next to the state file. They are
+ * committed in groups, when enough changes are pending or shortly after the
+ * first one, instead of rewriting anything per file. compact() folds the
+ * journal into a new state file; a journal left behind by a crash is
+ * replayed when the store is loaded.
+ *
+ * Paths are relative to the project directory.
+ */
+class UploadStateStore : public QObject
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Returns the store for an upload-profile, creates it on first use.
+     * The store is a child of the project and deleted with it.
+     */
+    static UploadStateStore* forProfile(KDevelop::IProject* project, const KConfigGroup& profile);
+
+    /**
+     * Deletes the store and the state file of a removed upload-profile
+     * @param profileGroup name of the profile's config group, eg. "Profile1"
+     */
+    static void discard(KDevelop::IProject* project, const QString& profileGroup);
+
+    ~UploadStateStore() override;
+
+    bool contains(const QString& path);
+    QDateTime uploadTime(const QString& path);
+    UploadFingerprint fingerprint(const QString& path);
+
+    /**
+     * Returns true if a local file changed since it was uploaded, or was never uploaded.
+     * Compares the fingerprint, or the upload time for entries from before fingerprints.
+     * A file that was only touched gets its new stat recorded, so it isn't hashed again.
+     */
+    bool isModified(const QString& path, const QString& localFile);
+
+    /**
+     * Compares a local file with a recorded fingerprint or upload time, without a store.
+     * Safe to call from worker threads.
+     * @param touched set to the new stat with the recorded hash if the file was only touched,
+     *                invalid otherwise
+     */
+    static bool isModified(const UploadFingerprint& recorded, const QDateTime& uploadTime,
+                           const QString& localFile, UploadFingerprint* touched);
+
+    void setUploaded(const QString& path, const QDateTime& time);
+    void setFingerprint(const QString& path, const UploadFingerprint& fingerprint);
+    void remove(const QString& path);
+
+    /**
+     * Moves the entry of a file that was renamed in the destination along with the local file
+     */
+    void move(const QString& from, const QString& to);
+
+    /**
+     * Marks many paths as uploaded with a single journal write
+     */
+    void setUploaded(const QStringList& paths, const QDateTime& time);
+
+    /**
+     * Sets the fingerprints of many paths with a single journal write
+     */
+    void setFingerprints(const QStringList& paths, const QList<UploadFingerprint>& fingerprints);
+
+    /**
+     * Returns the check states the user selected in the UploadDialog, by path
+     */
+    QHash<QString, Qt::CheckState> selection() const;
+
+    /**
+     * Stores the check states the user selected, an empty selection removes the file
+     */
+    void setSelection(const QHash<QString, Qt::CheckState>& selection);
+
+    /**
+     * Returns all paths that have an entry
+     */
+    QStringList paths();
+
+    /**
+     * Removes many entries with a single journal write
+     */
+    void remove(const QStringList& paths);
+
+    /**
+     * Removes the entries of files and folders that don't exist below base anymore.
+     * The files are stat'ed on a worker thread, the entries are removed when it is done.
+     */
+    void collectGarbage(const KDevelop::Path& base);
+
+    /**
+     * Writes the changes to the state file and empties the journal
+     */
+    bool compact();
+
+public Q_SLOTS:
+    /**
+     * Commits the pending changes to the journal
+     */
+    bool sync();
+
+Q_SIGNALS:
+    /**
+     * Emitted when the entries of paths were set or removed
+     */
+    void entriesChanged(const QStringList& paths);
+
+private Q_SLOTS:
+    /**
+     * Called by the worker of collectGarbage() with the paths whose files are gone
+     */
+    void removeGarbage(const QString& base, const QStringList& missing);
+
+private:
+    struct Entry {
+        Entry() {}
+        QDateTime uploadTime;
+        UploadFingerprint fingerprint;
+    };
+
+    UploadStateStore(const QString& fileName, const KConfigGroup& profile, QObject* parent);
+
+    enum JournalOperation {
+        SetEntry,
+        RemoveEntry
+    };
+
+    static QString fileName(KDevelop::IProject* project, const QString& profileGroup);
+
+    /**
+     * Stores a changed entry and queues it for the journal
+     */
+    void change(const QString& path, const Entry& entry);
+
+    static QByteArray journalRecord(JournalOperation operation, const QString& path, const Entry& entry);
+
+    /**
+     * Adds a record to the pending journal group, commits the group if it is full
+     */
+    void appendJournal(JournalOperation operation, const QString& path, const Entry& entry = Entry());
+
+    /**
+     * Applies the records of the journal to the changes
+     * @return number of replayed records
+     */
+    int replayJournal();
+
+    /**
+     * Maps the state file, migrates the entries from the project configuration if there is none
+     */
+    void load();
+
+    /**
+     * Moves upload times and fingerprints from the profile's config group to the store
+     */
+    void migrate();
+
+    /**
+     * Looks up an entry in the changes and the mapped file
+     */
+    bool lookup(const QString& path, Entry* entry);
+
+    /**
+     * Binary search in the mapped file
+     * @return record number or -1
+     */
+    int findRecord(const QByteArray& path) const;
+    QByteArray recordPath(int record) const;
+    Entry recordEntry(int record) const;
+
+    /**
+     * Maps the state file and checks its header
+     */
+    void map();
+    void unmap();
+
+    QFile m_file;
+    KConfigGroup m_profile; ///< config group of the profile, source of the migration
+    bool m_loaded;
+    const uchar* m_data; ///< mapped state file, nullptr if there is none
+    quint32 m_count; ///< records in the mapped file
+
+    QHash<QString, Entry> m_changes; ///< entries changed since the last compact
+    QSet<QString> m_removed; ///< entries removed since the last compact
+
+    QFile m_journal;
+    QByteArray m_pendingRecords; ///< journal records that are not committed yet
+    int m_pendingCount;
+    QTimer m_commitTimer; ///< commits pending records a while after the first one
+    QThreadPool m_workers; ///< runs collectGarbage(), waited for when the store is deleted
+    bool m_collecting; ///< if collectGarbage() is running
+};
+
+#endif
+// kate: space-indent on; indent-width 4; tab-width 4; replace-tabs on